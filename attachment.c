@@ -3,16 +3,145 @@
 
 #include "attachment.h"
 #include "base64.h"
+#include "charset.h"
+#include "crlf.h"
 #include "error.h"
+#include "gz.h"
+#include "qp.h"
+#include "scan.h"
+#include "uring.h"
 #include "util.h"
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #ifdef DEBUG
 static void att_dump(att_p A);
 #endif
 
+/* Parallel printing of a set.
+ *
+ * The size of every part is known before printing: head and tail are printed
+ * into a counter, the content size follows from the size of the payload and
+ * the transfer format. Thus each part has its own region of the output, and
+ * workers print parts at once, largest first, each by positional writes into
+ * its region. */
+
+/* Below this size, threads cost more than they save */
+#define ATT_PAR_MIN_SIZE 1048576L
+
+typedef struct att_job_t
+{
+    att_p A;
+    int   body;
+    int   last;
+    off_t off;  /* Offset of the part in the output */
+    off_t size; /* Head, content and tail */
+    int   res;
+    char  message[MAX_ERROR_SIZE]; /* error_message of the worker, if failed */
+}* att_job_p;
+
+typedef struct att_par_t
+{
+    pthread_mutex_t lock;
+
+    file_p      F;
+    const char* boundary;
+
+    att_job_p  jobs; /* In print order */
+    att_job_p* order; /* In claim order */
+    int        count;
+    int        next; /* Next job to claim, in order */
+}* att_par_p;
+
+/* Longest line allowed in 7bit content (RFC 5322), line break excluded */
+#define ATT_7BIT_MAX_LINE 998
+
+/** Open the file of A, whose content is read transcoded from its charset */
+static int att_open(att_p A, file_p F);
+
+/**
+ * Transcode the inline payload of A, if any, to UTF-8 once and for all; A is
+ * then in UTF-8.
+ */
+static int att_transcode(att_p A);
+
+/** Compress the inline payload of A, if asked to, once and for all */
+static int att_compress(att_p A);
+
+/* Boundaries drawn before giving up: a collision is a 26^-52 event already */
+#define ATT_BOUNDARY_TRIES 8
+
+/**
+ * Look for the ATT_BOUNDARY_SIZE letters at `boundary` in the content of A, as
+ * printed before the transfer encoding; *found is set accordingly.
+ *
+ * The same read finds A->crlf_prefix of a 7bit part, so that it is not read
+ * once more by crlf_file_to_file before the kernel copy.
+ */
+static int att_find_boundary(att_p A, const char* boundary, int* found);
+
+/** Look for `boundary` in the `n` bytes at `buf` */
+static int att_has_boundary(const char* boundary, const char* buf, size_t n);
+
+/** Scan the content of A, from its beginning */
+static int att_scan(att_p A, scan_p S);
+
+/**
+ * Scan the content of A and set A->fmt to the smallest valid format: 7bit if
+ * allowed, else the smaller of quoted-printable (for text: no NUL) and base64.
+ */
+static int att_choose_fmt(att_p A);
+
+/* Input bytes read per step by att_copy_8bit */
+#define ATT_CHUNK 49152
+
+/**
+ * Check the content scanned so far against 8bit rules (RFC 2045): no NUL,
+ * <CR> and <LF> only as <CR><LF>, lines up to ATT_7BIT_MAX_LINE bytes. If
+ * `end` is zero, more content may follow.
+ *
+ * Return OK or ILLEGAL_FORMAT.
+ */
+static int att_check_8bit(att_p A, scan_p S, int end);
+
+/** Write the inline payload of A, checked against 8bit rules, into F */
+static int att_write_8bit(att_p A, file_p F);
+
+/** Copy `in` into F, checking it against 8bit rules on the fly */
+static int att_copy_8bit(att_p A, file_p F, file_p in);
+
+static int att_print_head(att_p A, file_p F, int body);
+static int att_print_content(att_p A, file_p F);
+static int att_print_tail(att_p A, file_p F, const char* boundary, int last);
+
+/**
+ * Size of the content of A, once encoded; 7bit content, and content to
+ * transcode, is scanned, while quoted-printable and re-wrapped base64 content
+ * is encoded once, just to be measured.
+ *
+ * Return NOT_FOUND if it cannot be known in advance (e.g. A is not a regular
+ * file, or it is to be compressed).
+ */
+static int att_content_size(att_p A, off_t* size);
+
+/**
+ * Print parts of A, following the first boundary, on att_threads workers.
+ *
+ * Return NOT_FOUND, with nothing written, if the set is too small or sizes are
+ * not known in advance: the caller shall print serially.
+ */
+static int att_par_print(att_set_p A, file_p F, const char* boundary);
+
+static void* att_par_worker(void* arg);
+static int   att_job_cmp(const void* a, const void* b);
+
+/** Number of threads printing parts of a set; 1 disables parallel printing */
+static unsigned int att_threads = 1;
+
 const char* ATT_SIGNATURE_FILENAME = "OpenPGP_signature.asc";
 const char* ATT_NOMIME             = "NOMIME";
 
@@ -23,12 +152,31 @@ void att_set_init(att_set_p A)
     A->body_index = -1;
 }
 
+void att_set_free(att_set_p A)
+{
+    int cur;
+
+    for (cur = 0; cur < A->count; ++cur)
+    {
+        free(A->attachments[cur].data);
+        A->attachments[cur].data = NULL;
+    }
+}
+
 int att_init(
     att_p A, const char* mime, const char* filename, const char* path, int fmt
 )
 {
-    A->F   = NULL;
-    A->fmt = fmt;
+    A->F           = NULL;
+    A->fmt         = fmt;
+    A->data        = NULL;
+    A->data_size   = 0;
+    A->line_length = BASE64_LINE_LENGTH;
+    A->auto_fmt    = 0;
+    A->src_base64  = 0;
+    A->charset     = CHARSET_UTF8;
+    A->gzip        = 0;
+    A->crlf_prefix = -1;
 
     if (mime == NULL)
     {
@@ -55,9 +203,7 @@ int att_init(
 
 int att_print(att_p A, file_p F, const char* boundary, int body, int last)
 {
-    int           ret = OK;
-    int           nomime;
-    struct file_t tmp_file;
+    int ret = OK;
 
 #ifdef DEBUG
     if (body)
@@ -67,82 +213,282 @@ int att_print(att_p A, file_p F, const char* boundary, int body, int last)
     att_dump(A);
 #endif
 
-    nomime = strcmp(A->mime, ATT_NOMIME) == 0;
-    if (!nomime)
+    ret = att_print_head(A, F, body);
+    return_iferr(ret);
+
+    ret = att_print_content(A, F);
+    return_iferr(ret);
+
+    return att_print_tail(A, F, boundary, last);
+}
+
+static int att_open(att_p A, file_p F)
+{
+    int ret;
+
+    ret = file_open(F, A->path, O_RDONLY, 0444);
+    if (ret != 0)
     {
-        ret = file_write_strv(F, "Content-Type: ", A->mime, NULL);
+        strnappendv(
+            error_message, MAX_ERROR_SIZE, "att_print: open; ", A->path, NULL
+        );
+        return ret;
+    }
+
+    /* Read ahead by io_uring, if enabled; by read(2) otherwise */
+    uring_open(F);
+
+    if (A->charset != CHARSET_UTF8)
+        file_set_charset(F, F, A->charset);
+
+    if (A->gzip)
+    {
+        ret = gz_open(F, F);
+        if (ret != OK)
+            file_close(F);
+    }
+
+    return ret;
+}
+
+static int att_transcode(att_p A)
+{
+    char*  data;
+    size_t size;
+
+    if (A->data == NULL || A->charset == CHARSET_UTF8)
+        return OK;
+
+    /* Pure ASCII is UTF-8 already */
+    size = charset_utf8_size(A->charset, A->data, A->data_size);
+    if (size != A->data_size)
+    {
+        data = malloc(size);
+        if (data == NULL)
+        {
+            strncpy(error_message, "att_print: transcode", MAX_ERROR_SIZE);
+            return ERRNO_SPLIT + ENOMEM;
+        }
+
+        charset_to_utf8(A->charset, data, A->data, A->data_size);
+
+        free(A->data);
+        A->data      = data;
+        A->data_size = size;
+    }
+
+    A->charset = CHARSET_UTF8;
+
+    return OK;
+}
+
+static int att_compress(att_p A)
+{
+    int    ret;
+    char*  data;
+    size_t size;
+
+    if (A->data == NULL || !A->gzip)
+        return OK;
+
+    ret = gz_buf(A->data, A->data_size, &data, &size);
+    return_iferr(ret);
+
+    free(A->data);
+    A->data      = data;
+    A->data_size = size;
+    A->gzip      = 0;
+
+    return OK;
+}
+
+static int att_scan(att_p A, scan_p S)
+{
+    int           ret = OK;
+    struct file_t tmp_file;
+
+    if (A->data != NULL)
+    {
+        scan_start(S);
+        scan_buf(S, A->data, A->data_size);
+        scan_end(S);
+    }
+    else if (!file_is_init(A->F))
+    {
+        ret = att_open(A, &tmp_file);
         return_iferr(ret);
 
-        if (strcmp(A->mime, "application/pgp-signature") == 0)
-            ret = file_write_strv(F, "; name=\"signature.asc\"\r\n", NULL);
+        ret = scan_file(S, &tmp_file);
+        file_close(&tmp_file);
+    }
+    else
+        ret = scan_file(S, A->F);
+
+    return ret;
+}
+
+static int att_choose_fmt(att_p A)
+{
+    int           ret = OK;
+    struct scan_t S;
+    off_t         qp_size;
+
+    ret = att_scan(A, &S);
+    return_iferr(ret);
+
+    /* Bare <LF>s are fine: 7bit content is canonicalized when printed */
+    if (S.nul == 0 && S.high == 0 && S.cr == S.crlf &&
+        S.max_line <= ATT_7BIT_MAX_LINE)
+    {
+        A->fmt = ATT_FMT_7BIT;
+        return OK;
+    }
+
+    /* Escapes take 3 chars, line breaks become <CR><LF>, and lines are split
+     * every QP_LINE_LENGTH - 1 chars at most */
+    qp_size = (off_t)(S.size + 2 * (S.escapes + S.cr - S.crlf) + S.lf - S.crlf);
+    qp_size += qp_size / (QP_LINE_LENGTH - 1) * 3;
+
+    if (S.nul == 0 &&
+        qp_size < base64_encoded_size((off_t)S.size, A->line_length))
+        A->fmt = ATT_FMT_QP;
+    else
+        A->fmt = ATT_FMT_BASE64;
+
+    return OK;
+}
+
+static int att_print_head(att_p A, file_p F, int body)
+{
+    int                 ret = OK;
+    const char*         cte = NULL;
+    struct file_batch_t B;
+
+    if (strcmp(A->mime, ATT_NOMIME) == 0)
+        return OK;
+
+    /* The whole head goes with a single writev */
+    file_batch_init(&B, F);
+
+    ret = file_batch_addv(&B, "Content-Type: ", A->mime, NULL);
+    return_iferr(ret);
+
+    if (strcmp(A->mime, "application/pgp-signature") == 0)
+        ret = file_batch_addv(&B, "; name=\"signature.asc\"\r\n", NULL);
+    else
+        ret = file_batch_addv(&B, "; charset=UTF-8\r\n", NULL);
+    return_iferr(ret);
+
+    if (!body && *A->filename)
+    {
+        if (strcmp(A->filename, ATT_SIGNATURE_FILENAME) == 0)
+            ret = file_batch_addv(
+                &B,
+                "Content-Description: OpenPGP digital signature\r\n",
+                "Content-Disposition: attachment; filename=\"",
+                A->filename,
+                "\"\r\n",
+                NULL
+            );
         else
-            ret = file_write_strv(F, "; charset=UTF-8\r\n", NULL);
+            ret = file_batch_addv(
+                &B,
+                "Content-Disposition: attachment; filename=\"",
+                A->filename,
+                "\"\r\n",
+                NULL
+            );
+
         return_iferr(ret);
+    }
 
-        if (!body && *A->filename)
-        {
-            if (strcmp(A->filename, ATT_SIGNATURE_FILENAME) == 0)
-                ret = file_write_strv(
-                    F,
-                    "Content-Description: OpenPGP digital signature\r\n",
-                    "Content-Disposition: attachment; filename=\"",
-                    A->filename,
-                    "\"\r\n",
-                    NULL
-                );
-            else
-                ret = file_write_strv(
-                    F,
-                    "Content-Disposition: attachment; filename=\"",
-                    A->filename,
-                    "\"\r\n",
-                    NULL
-                );
+    switch (A->fmt)
+    {
+    case ATT_FMT_BASE64:
+        cte = "Content-Transfer-Encoding: base64\r\n";
+        break;
+    case ATT_FMT_7BIT:
+        cte = "Content-Transfer-Encoding: 7bit\r\n";
+        break;
+    case ATT_FMT_QP:
+        cte = "Content-Transfer-Encoding: quoted-printable\r\n";
+        break;
+    case ATT_FMT_8BIT:
+        cte = "Content-Transfer-Encoding: 8bit\r\n";
+        break;
+    case ATT_FMT_BINARY:
+        cte = "Content-Transfer-Encoding: binary\r\n";
+        break;
+    }
 
-            return_iferr(ret);
-        }
+    if (cte != NULL)
+        ret = file_batch_addv(&B, cte, NULL);
+    return_iferr(ret);
 
+    ret = file_batch_addv(&B, "\r\n", NULL);
+    return_iferr(ret);
+
+    return file_batch_flush(&B);
+}
+
+static int att_print_content(att_p A, file_p F)
+{
+    int           ret = OK;
+    struct file_t tmp_file;
+
+    if (A->data != NULL)
+    {
         switch (A->fmt)
         {
         case ATT_FMT_BASE64:
-            ret = file_write_strv(
-                F, "Content-Transfer-Encoding: base64\r\n", NULL
-            );
+            if (A->src_base64)
+                ret = base64_rewrap_buf(
+                    A->data, A->data_size, F, A->line_length
+                );
+            else
+                ret = base64_buf_to_file(
+                    A->data, A->data_size, F, A->line_length
+                );
             break;
         case ATT_FMT_7BIT:
-            ret =
-                file_write_strv(F, "Content-Transfer-Encoding: 7bit\r\n", NULL);
+            ret = crlf_buf_to_file(A->data, A->data_size, F);
+            break;
+        case ATT_FMT_BINARY:
+            ret = file_write(F, A->data, A->data_size);
+            break;
+        case ATT_FMT_8BIT:
+            ret = att_write_8bit(A, F);
+            break;
+        case ATT_FMT_QP:
+            ret = qp_buf_to_file(A->data, A->data_size, F);
             break;
         }
-        return_iferr(ret);
-
-        ret = file_write_strv(F, "\r\n", NULL);
-        return_iferr(ret);
     }
-
-    if (!file_is_init(A->F))
+    else if (!file_is_init(A->F))
     {
-        ret = file_open(&tmp_file, A->path, O_RDONLY, 0444);
-        if (ret != 0)
-        {
-            strnappendv(
-                error_message,
-                MAX_ERROR_SIZE,
-                "att_print: open; ",
-                A->path,
-                NULL
-            );
-            assert(0, ret, error_message);
-        }
+        ret = att_open(A, &tmp_file);
+        return_iferr(ret);
 
         switch (A->fmt)
         {
         case ATT_FMT_BASE64:
-            ret = base64_file_to_file(&tmp_file, F, 80);
+            if (A->src_base64)
+                ret = base64_rewrap_file(&tmp_file, F, A->line_length);
+            else
+                ret = base64_file_to_file(&tmp_file, F, A->line_length);
             break;
         case ATT_FMT_7BIT:
+            ret = crlf_file_to_file(&tmp_file, F, A->crlf_prefix);
+            break;
+        case ATT_FMT_BINARY:
             ret = file_copy(F, &tmp_file);
             break;
+        case ATT_FMT_8BIT:
+            ret = att_copy_8bit(A, F, &tmp_file);
+            break;
+        case ATT_FMT_QP:
+            ret = qp_file_to_file(&tmp_file, F);
+            break;
         }
 
         file_close(&tmp_file);
@@ -152,52 +498,207 @@ int att_print(att_p A, file_p F, const char* boundary, int body, int last)
         switch (A->fmt)
         {
         case ATT_FMT_BASE64:
-            ret = base64_file_to_file(A->F, F, 80);
+            if (A->src_base64)
+                ret = base64_rewrap_file(A->F, F, A->line_length);
+            else
+                ret = base64_file_to_file(A->F, F, A->line_length);
             break;
         case ATT_FMT_7BIT:
+            ret = crlf_file_to_file(A->F, F, -1);
+            break;
+        case ATT_FMT_BINARY:
             ret = file_copy(F, A->F);
             break;
+        case ATT_FMT_8BIT:
+            ret = att_copy_8bit(A, F, A->F);
+            break;
+        case ATT_FMT_QP:
+            ret = qp_file_to_file(A->F, F);
+            break;
         }
     }
 
+    return ret;
+}
+
+static int att_check_8bit(att_p A, scan_p S, int end)
+{
+    /* A trailing <CR> may still be followed by <LF> */
+    int cr_held = !end && S->last_cr;
+
+    if (S->nul == 0 && S->cr - S->crlf == (size_t)cr_held &&
+        S->lf == S->crlf && S->max_line <= ATT_7BIT_MAX_LINE &&
+        S->line - (size_t)cr_held <= ATT_7BIT_MAX_LINE)
+        return OK;
+
+    strnappendv(
+        error_message,
+        MAX_ERROR_SIZE,
+        "att_print: not valid 8bit content; ",
+        *A->path ? A->path : "inline payload",
+        NULL
+    );
+
+    return ILLEGAL_FORMAT;
+}
+
+static int att_write_8bit(att_p A, file_p F)
+{
+    int           ret;
+    struct scan_t S;
+
+    scan_start(&S);
+    scan_buf(&S, A->data, A->data_size);
+    scan_end(&S);
+
+    ret = att_check_8bit(A, &S, 1);
     return_iferr(ret);
 
+    return file_write(F, A->data, A->data_size);
+}
+
+static int att_copy_8bit(att_p A, file_p F, file_p in)
+{
+    char          buf[ATT_CHUNK];
+    ssize_t       rb;
+    int           ret;
+    struct scan_t S;
+
+    scan_start(&S);
+
+    if (file_isreg(in))
+    {
+        ret = file_seek(in, 0, SEEK_SET);
+        return_iferr(ret);
+    }
+
+    while ((rb = file_read(in, buf, sizeof(buf))) > 0)
+    {
+        scan_buf(&S, buf, (size_t)rb);
+
+        ret = att_check_8bit(A, &S, 0);
+        return_iferr(ret);
+
+        ret = file_write(F, buf, (size_t)rb);
+        return_iferr(ret);
+    }
+
+    if (rb < 0)
+    {
+        strncpy(error_message, "att_print: read", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + errno;
+    }
+
+    scan_end(&S);
+
+    return att_check_8bit(A, &S, 1);
+}
+
+static int att_print_tail(att_p A, file_p F, const char* boundary, int last)
+{
+    int                 ret = OK;
+    struct file_batch_t B;
+
+    file_batch_init(&B, F);
+
     /* In case of body to sign, a trailing <CR><LF> is needed to clearly
      * separate the signed body and the boundary */
-    if (nomime)
+    if (strcmp(A->mime, ATT_NOMIME) == 0)
     {
-        ret = file_write_strv(F, "\r\n", NULL);
+        ret = file_batch_addv(&B, "\r\n", NULL);
         return_iferr(ret);
     }
-
-    if (!nomime)
+    else
     {
-        ret = file_write_str(F, "\r\n");
+        ret = file_batch_addv(&B, "\r\n", NULL);
         return_iferr(ret);
 
         switch (A->fmt)
         {
         case ATT_FMT_7BIT:
+        case ATT_FMT_QP:
+        case ATT_FMT_8BIT:
+        case ATT_FMT_BINARY:
             break;
         default:
-            ret = file_write_str(F, "\r\n");
+            ret = file_batch_addv(&B, "\r\n", NULL);
             return_iferr(ret);
             break;
         }
     }
 
-    ret = file_write_strv(F, "--------------", boundary, NULL);
+    ret = file_batch_addv(&B, "--------------", boundary, NULL);
     return_iferr(ret);
 
     if (last)
     {
-        ret = file_write_str(F, "--");
+        ret = file_batch_addv(&B, "--", NULL);
         return_iferr(ret);
     }
 
-    ret = file_write_str(F, "\r\n");
+    ret = file_batch_addv(&B, "\r\n", NULL);
+    return_iferr(ret);
+
+    return file_batch_flush(&B);
+}
 
-    return ret;
+static int att_content_size(att_p A, off_t* size)
+{
+    struct stat   s;
+    struct scan_t S;
+    struct file_t counter;
+
+    if (A->data != NULL)
+        *size = (off_t)A->data_size;
+    else if (!file_is_init(A->F) && stat(A->path, &s) == 0 &&
+             S_ISREG(s.st_mode))
+        *size = s.st_size;
+    else
+        return NOT_FOUND;
+
+    /* Compressing twice, once just to measure, costs more than it saves */
+    if (A->gzip)
+        return NOT_FOUND;
+
+    /* Transcoding changes the size of the payload */
+    if (A->charset != CHARSET_UTF8)
+    {
+        if (att_scan(A, &S) != OK)
+            return NOT_FOUND;
+
+        *size = (off_t)S.size;
+    }
+
+    switch (A->fmt)
+    {
+    case ATT_FMT_BASE64:
+        if (A->src_base64)
+            break;
+
+        *size = base64_encoded_size(*size, A->line_length);
+        return OK;
+    case ATT_FMT_7BIT:
+        /* A <CR> is added to each bare <LF> */
+        if (att_scan(A, &S) != OK)
+            return NOT_FOUND;
+
+        *size = (off_t)(S.size + S.lf - S.crlf);
+        return OK;
+    case ATT_FMT_8BIT:
+    case ATT_FMT_BINARY:
+        return OK;
+    case ATT_FMT_QP:
+        break;
+    default:
+        return NOT_FOUND;
+    }
+
+    file_set_count(&counter);
+    if (att_print_content(A, &counter) != OK)
+        return NOT_FOUND;
+
+    *size = counter.at;
+    return OK;
 }
 
 int att_set_add(
@@ -225,7 +726,9 @@ int att_set_add(
     return ret;
 }
 
-int att_set_add_by_command(att_set_p A, int* COMM, int is_body)
+int att_set_add_by_command(
+    att_set_p A, comm_arena_p COMM, int is_body, char* block, size_t block_size
+)
 {
     int ret = OK;
     int fmt = ATT_FMT_LBOUND;
@@ -234,6 +737,19 @@ int att_set_add_by_command(att_set_p A, int* COMM, int is_body)
     struct comm_t filename_c;
     struct comm_t path_c;
     struct comm_t fmt_c;
+    struct comm_t size_c;
+    struct comm_t ll_c;
+    struct comm_t source_c;
+    struct comm_t charset_c;
+    struct comm_t compress_c;
+    int           is_inline   = 0;
+    int           is_auto     = 0;
+    int           is_base64   = 0;
+    int           charset     = CHARSET_UTF8;
+    int           is_gzip     = 0;
+    size_t        inline_size = 0;
+    size_t        line_length = BASE64_LINE_LENGTH;
+    att_p         att;
 
     if (ret == OK)
         if (comm_get(COMM, "mime-type", &mime_c) == NOT_FOUND ||
@@ -251,7 +767,17 @@ int att_set_add_by_command(att_set_p A, int* COMM, int is_body)
             strncpy(error_message, "no filename provided", MAX_ERROR_SIZE);
         }
 
-    if (ret == OK)
+    if (ret == OK && comm_get(COMM, "inline-size", &size_c) == OK)
+    {
+        is_inline    = 1;
+        ret          = strtosize(size_c.value, &inline_size);
+        path_c.value = NULL;
+
+        if (ret != OK)
+            strncpy(error_message, "invalid inline-size", MAX_ERROR_SIZE);
+    }
+
+    if (ret == OK && !is_inline)
         if (comm_get(COMM, "path", &path_c) == NOT_FOUND ||
             path_c.value == NULL)
         {
@@ -261,7 +787,16 @@ int att_set_add_by_command(att_set_p A, int* COMM, int is_body)
 
     if (ret == OK)
     {
-        if (comm_get(COMM, "fmt", &fmt_c) != NOT_FOUND)
+        if (comm_get(COMM, "fmt", &fmt_c) == NOT_FOUND)
+        {
+            fmt = ATT_FMT_BASE64;
+        }
+        else if (fmt_c.value != NULL && strcmp(fmt_c.value, "auto") == 0)
+        {
+            is_auto = 1;
+            fmt     = ATT_FMT_BASE64;
+        }
+        else
         {
             if (fmt_c.value != NULL)
                 fmt = fmt_c.value[0] - '0';
@@ -273,12 +808,71 @@ int att_set_add_by_command(att_set_p A, int* COMM, int is_body)
                 strncpy(error_message, "invalid fmt provided", MAX_ERROR_SIZE);
             }
         }
+    }
+
+    if (ret == OK && comm_get(COMM, "source", &source_c) == OK)
+    {
+        if (source_c.value == NULL || strcmp(source_c.value, "base64") != 0)
+        {
+            ret = ILLEGAL_FORMAT;
+            strncpy(error_message, "invalid source", MAX_ERROR_SIZE);
+        }
+        else if (is_auto || fmt != ATT_FMT_BASE64)
+        {
+            ret = ILLEGAL_FORMAT;
+            strncpy(
+                error_message, "source=base64 needs fmt=1", MAX_ERROR_SIZE
+            );
+        }
         else
+            is_base64 = 1;
+    }
+
+    if (ret == OK && comm_get(COMM, "line-length", &ll_c) == OK)
+    {
+        if (strtosize(ll_c.value, &line_length) != OK || line_length < 4 ||
+            line_length > BASE64_MAX_LINE_LENGTH || line_length % 4 != 0)
         {
-            fmt = ATT_FMT_BASE64;
+            ret = ILLEGAL_FORMAT;
+            strncpy(error_message, "invalid line-length", MAX_ERROR_SIZE);
         }
     }
 
+    if (ret == OK && comm_get(COMM, "charset", &charset_c) == OK)
+    {
+        if (charset_c.value == NULL ||
+            charset_find(charset_c.value, &charset) != OK)
+        {
+            ret = ILLEGAL_FORMAT;
+            strncpy(error_message, "invalid charset", MAX_ERROR_SIZE);
+        }
+    }
+
+    if (ret == OK && comm_get(COMM, "compress", &compress_c) == OK)
+    {
+        if (compress_c.value == NULL || strcmp(compress_c.value, "gzip") != 0)
+        {
+            ret = ILLEGAL_FORMAT;
+            strncpy(error_message, "invalid compress", MAX_ERROR_SIZE);
+        }
+        else if (is_body || is_auto || is_base64 || fmt != ATT_FMT_BASE64)
+        {
+            ret = ILLEGAL_FORMAT;
+            strncpy(
+                error_message,
+                "compress=gzip needs an attachment with fmt=1",
+                MAX_ERROR_SIZE
+            );
+        }
+        else if (strlen(filename_c.value) + sizeof(GZ_SUFFIX) > MAX_PATH_SIZE)
+        {
+            ret = STRING_TOO_LONG;
+            strncpy(error_message, "Filename too long", MAX_ERROR_SIZE);
+        }
+        else
+            is_gzip = 1;
+    }
+
     if (ret == OK)
     {
         if (is_body)
@@ -289,6 +883,43 @@ int att_set_add_by_command(att_set_p A, int* COMM, int is_body)
             );
     }
 
+    if (ret == OK)
+    {
+        A->attachments[A->count - 1].line_length = (int)line_length;
+        A->attachments[A->count - 1].auto_fmt    = is_auto;
+        A->attachments[A->count - 1].src_base64  = is_base64;
+        A->attachments[A->count - 1].charset     = charset;
+    }
+
+    if (ret == OK && is_gzip)
+    {
+        att = A->attachments + A->count - 1;
+
+        att->gzip = 1;
+        strcpy(att->mime, GZ_MIME);
+        strcat(att->filename, GZ_SUFFIX);
+    }
+
+    if (ret == OK && is_inline)
+    {
+        att = A->attachments + A->count - 1;
+
+        /* Never NULL, even for an empty payload */
+        if (block != NULL && block_size == inline_size)
+            att->data = block;
+        else
+            att->data = malloc(inline_size > 0 ? inline_size : 1);
+
+        if (att->data == NULL)
+        {
+            --A->count;
+            strncpy(error_message, "inline payload", MAX_ERROR_SIZE);
+            ret = ERRNO_SPLIT + ENOMEM;
+        }
+        else
+            att->data_size = inline_size;
+    }
+
     if (ret == OK && is_body)
         att_set_set_body_index(A);
 
@@ -306,15 +937,174 @@ void att_set_set_body_index(att_set_p A)
 #endif
 }
 
+void att_set_threads(unsigned int threads)
+{
+    att_threads = threads > 0 ? threads : 1;
+}
+
+int att_set_prepare(att_set_p A)
+{
+    int cur;
+    int ret;
+
+    for (cur = 0; cur < A->count; ++cur)
+    {
+        ret = att_transcode(A->attachments + cur);
+        return_iferr(ret);
+
+        ret = att_compress(A->attachments + cur);
+        return_iferr(ret);
+
+        if (A->attachments[cur].auto_fmt)
+        {
+            ret = att_choose_fmt(A->attachments + cur);
+            return_iferr(ret);
+        }
+    }
+
+    return OK;
+}
+
+int att_set_boundary(att_set_p A, char* boundary)
+{
+    int tries;
+    int cur;
+    int found = 1;
+    int ret;
+
+    /* Files may have changed since the last print: prefixes are found again */
+    for (cur = 0; cur < A->count; ++cur)
+        A->attachments[cur].crlf_prefix = -1;
+
+    for (tries = 0; found && tries < ATT_BOUNDARY_TRIES; ++tries)
+    {
+        get_rand_string(boundary, ATT_BOUNDARY_SIZE);
+        boundary[ATT_BOUNDARY_SIZE] = '\0';
+
+        found = 0;
+        for (cur = 0; !found && cur < A->count; ++cur)
+        {
+            ret = att_find_boundary(A->attachments + cur, boundary, &found);
+            return_iferr(ret);
+        }
+    }
+
+    if (found)
+    {
+        strncpy(error_message, "att_set_boundary: collision", MAX_ERROR_SIZE);
+        return ILLEGAL_FORMAT;
+    }
+
+    return OK;
+}
+
+static int att_find_boundary(att_p A, const char* boundary, int* found)
+{
+    /* The tail of a chunk is kept, for a boundary across two chunks */
+    char          buf[ATT_BOUNDARY_SIZE - 1 + ATT_CHUNK];
+    size_t        held = 0;
+    ssize_t       rb;
+    int           ret = OK;
+    struct file_t tmp_file;
+
+    /* Bytes before the first bare <LF>, counted until it is found */
+    off_t  prefix   = 0;
+    size_t run      = 0;
+    int    after_cr = 0;
+    int    known    = A->fmt != ATT_FMT_7BIT || A->crlf_prefix >= 0;
+
+    *found = 0;
+
+    /* Base64 has no '-', thus no delimiter line */
+    if (A->fmt == ATT_FMT_BASE64)
+        return OK;
+
+    if (A->data != NULL)
+    {
+        *found = att_has_boundary(boundary, A->data, A->data_size);
+        return OK;
+    }
+
+    ret = att_open(A, &tmp_file);
+    return_iferr(ret);
+
+    while (!*found && (rb = file_read(&tmp_file, buf + held, ATT_CHUNK)) > 0)
+    {
+        if (!known)
+        {
+            run = crlf_bare_lf(buf + held, (size_t)rb, after_cr);
+            prefix += (off_t)run;
+            known    = run < (size_t)rb;
+            after_cr = buf[held + (size_t)rb - 1] == '\r';
+        }
+
+        held += (size_t)rb;
+        *found = att_has_boundary(boundary, buf, held);
+
+        if (held >= ATT_BOUNDARY_SIZE)
+        {
+            memmove(
+                buf, buf + held - (ATT_BOUNDARY_SIZE - 1), ATT_BOUNDARY_SIZE - 1
+            );
+            held = ATT_BOUNDARY_SIZE - 1;
+        }
+    }
+
+    if (!*found && rb < 0)
+    {
+        strncpy(error_message, "att_set_boundary: read", MAX_ERROR_SIZE);
+        ret = ERRNO_SPLIT + errno;
+    }
+
+    /* No bare <LF> up to the end */
+    if (!*found && rb == 0)
+        known = 1;
+
+    if (known && A->crlf_prefix < 0 && A->fmt == ATT_FMT_7BIT)
+        A->crlf_prefix = prefix;
+
+    file_close(&tmp_file);
+
+    return ret;
+}
+
+static int att_has_boundary(const char* boundary, const char* buf, size_t n)
+{
+    const char* end = buf + n;
+    const char* cur = buf;
+
+    while (end - cur >= ATT_BOUNDARY_SIZE &&
+           (cur = memchr(
+                cur, *boundary, (size_t)(end - cur) - (ATT_BOUNDARY_SIZE - 1)
+            )) != NULL)
+    {
+        if (memcmp(cur, boundary, ATT_BOUNDARY_SIZE) == 0)
+            return 1;
+        ++cur;
+    }
+
+    return 0;
+}
+
 int att_set_print(att_set_p A, file_p F, char* boundary)
 {
     int cur;
     int index_of_last_att;
     int ret = OK;
 
-    ret     = file_write_strv(F, "--------------", boundary, "\r\n", NULL);
+    ret = file_write_strv(F, "--------------", boundary, "\r\n", NULL);
     return_iferr(ret);
 
+    /* Positional writes go to the end of an O_APPEND file, whatever offset */
+    if (att_threads > 1 && A->count > 1 && F->mode == FILE_MODE_STREAM &&
+        file_isreg(F) && !file_isappend(F))
+    {
+        ret = att_par_print(A, F, boundary);
+        if (ret != NOT_FOUND)
+            return ret;
+        ret = OK;
+    }
+
     if (A->body_index >= 0)
     {
         assert(
@@ -341,6 +1131,160 @@ int att_set_print(att_set_p A, file_p F, char* boundary)
     return ret;
 }
 
+static int att_par_print(att_set_p A, file_p F, const char* boundary)
+{
+    struct att_par_t P;
+    struct file_t    counter;
+    pthread_t*       workers;
+    unsigned int     nworkers;
+    unsigned int     threads;
+    att_job_p        J;
+    off_t            content = 0;
+    off_t            off;
+    int              i;
+    int              res = OK;
+
+    P.F        = F;
+    P.boundary = boundary;
+    P.count    = 0;
+    P.next     = 0;
+    P.jobs     = malloc((size_t)A->count * sizeof(struct att_job_t));
+    P.order    = malloc((size_t)A->count * sizeof(att_job_p));
+
+    off        = file_cur(F);
+    if (P.jobs == NULL || P.order == NULL || off < 0)
+        res = NOT_FOUND;
+
+    /* Jobs are laid out in print order: the body first */
+    if (res == OK && A->body_index >= 0)
+    {
+        assert(
+            A->body_index < A->count,
+            FATAL_LOGIC,
+            "att_set_print: body index out of bound"
+        );
+        P.jobs[P.count].A    = A->attachments + A->body_index;
+        P.jobs[P.count].body = 1;
+        ++P.count;
+    }
+
+    for (i = 0; res == OK && i < A->count; ++i)
+        if (i != A->body_index)
+        {
+            P.jobs[P.count].A    = A->attachments + i;
+            P.jobs[P.count].body = 0;
+            ++P.count;
+        }
+
+    /* Head and tail are sized by printing them into a counter */
+    for (i = 0; res == OK && i < P.count; ++i)
+    {
+        J       = P.jobs + i;
+        J->last = i == P.count - 1;
+        J->off  = off;
+        J->res  = OK;
+
+        file_set_count(&counter);
+        if (att_content_size(J->A, &content) != OK ||
+            att_print_head(J->A, &counter, J->body) != OK ||
+            att_print_tail(J->A, &counter, boundary, J->last) != OK)
+            res = NOT_FOUND;
+
+        J->size      = counter.at + content;
+        off         += J->size;
+        P.order[i]   = J;
+    }
+
+    if (res == OK && off < ATT_PAR_MIN_SIZE)
+        res = NOT_FOUND;
+
+    threads = att_threads < (unsigned int)P.count ? att_threads
+                                                  : (unsigned int)P.count;
+    workers = malloc(threads * sizeof(pthread_t));
+    if (workers == NULL)
+        res = NOT_FOUND;
+
+    if (res == OK)
+    {
+        /* Largest first: the longest part starts as soon as possible */
+        qsort(P.order, (size_t)P.count, sizeof(att_job_p), att_job_cmp);
+
+        pthread_mutex_init(&P.lock, NULL);
+
+        for (nworkers = 0; nworkers < threads; ++nworkers)
+            if (pthread_create(workers + nworkers, NULL, att_par_worker, &P))
+                break;
+
+        /* Workers handle every job, as long as there is one */
+        res = nworkers > 0 ? OK : NOT_FOUND;
+
+        for (; nworkers > 0; --nworkers)
+            pthread_join(workers[nworkers - 1], NULL);
+
+        pthread_mutex_destroy(&P.lock);
+    }
+
+    /* Report the first failure in print order, as if printed serially */
+    for (i = 0; res == OK && i < P.count; ++i)
+    {
+        res = P.jobs[i].res;
+        if (res != OK)
+            memcpy(error_message, P.jobs[i].message, MAX_ERROR_SIZE);
+    }
+
+    if (res == OK)
+        res = file_seek(F, off, SEEK_SET);
+
+    free(workers);
+    free(P.order);
+    free(P.jobs);
+
+    return res;
+}
+
+static void* att_par_worker(void* arg)
+{
+    att_par_p     P = arg;
+    att_job_p     J;
+    struct file_t out;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&P->lock);
+        J = P->next < P->count ? P->order[P->next++] : NULL;
+        pthread_mutex_unlock(&P->lock);
+
+        if (J == NULL)
+            return NULL;
+
+        file_set_at(&out, P->F, J->off);
+        J->res = att_print(J->A, &out, P->boundary, J->body, J->last);
+
+        if (J->res == OK && out.at != J->off + J->size)
+        {
+            J->res = ILLEGAL_FORMAT;
+            strnappendv(
+                error_message,
+                MAX_ERROR_SIZE,
+                "att_set_print: changed while printing; ",
+                J->A->path,
+                NULL
+            );
+        }
+
+        if (J->res != OK)
+            memcpy(J->message, error_message, MAX_ERROR_SIZE);
+    }
+}
+
+static int att_job_cmp(const void* a, const void* b)
+{
+    off_t sa = (*(const att_job_p*)a)->size;
+    off_t sb = (*(const att_job_p*)b)->size;
+
+    return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
 #ifdef DEBUG
 static void att_dump(att_p A)
 {
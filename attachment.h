@@ -8,6 +8,9 @@
 #define MAX_MIME_SIZE 64
 #define MAX_ATTACHMENTS 512
 
+/* Random letters of a boundary, that follow its dashes */
+#define ATT_BOUNDARY_SIZE 52
+
 #include "comm.h"
 #include "io.h"
 
@@ -16,8 +19,11 @@ enum
 {
     ATT_FMT_LBOUND = 0,
     ATT_FMT_BASE64 = 1,
-    ATT_FMT_7BIT   = 2,
-    ATT_FMT_UBOUND = 3
+    ATT_FMT_7BIT   = 2, /* Bare <LF>s become <CR><LF> */
+    ATT_FMT_QP     = 3, /* Quoted-printable */
+    ATT_FMT_8BIT   = 4, /* Copied as is, once checked against RFC 2045 rules */
+    ATT_FMT_BINARY = 5, /* Copied as is */
+    ATT_FMT_UBOUND = 6
 };
 
 typedef struct att_t
@@ -27,6 +33,14 @@ typedef struct att_t
     char   filename[MAX_PATH_SIZE];
     int    fmt; /* Transfer format */
     file_p F;
+    char*  data;      /* Inline payload (heap); NULL if read from path or F */
+    size_t data_size; /* Inline payload size */
+    int    line_length; /* Base64 line length */
+    int    auto_fmt;    /* fmt is chosen by a scan of the content, on print */
+    int    src_base64;  /* The source is already base64 encoded */
+    int    charset;     /* CHARSET_* of the payload, printed as UTF-8 */
+    int    gzip;        /* The payload is compressed before being encoded */
+    off_t  crlf_prefix; /* Bytes before the first bare <LF>; -1: unknown */
 }* att_p;
 
 typedef struct att_set_t
@@ -45,11 +59,73 @@ extern int att_init(
 extern int att_print(att_p, file_p, const char* boundary, int body, int last);
 
 extern void att_set_init(att_set_p);
+extern void att_set_free(att_set_p);
 extern int  att_set_add(
      att_set_p, const char* mime, const char* filename, const char* path, int fmt
  );
-extern int  att_set_add_by_command(att_set_p, int* comm_arena, int is_body);
+/**
+ * Add an attachment (or the body) described by a command.
+ *
+ * The `fmt` key is a transfer format (ATT_FMT_*) or `auto`: the content is
+ * scanned each time it is printed and the smallest valid format among 7bit,
+ * quoted-printable and base64 is used; ATT_FMT_BASE64 by default.
+ *
+ * The optional `line-length` key sets the base64 line length: a multiple of 4
+ * in range [4; BASE64_MAX_LINE_LENGTH]; BASE64_LINE_LENGTH by default.
+ *
+ * The optional `source` key, whose only value is `base64`, marks the payload as
+ * already base64 encoded: it is checked and re-wrapped to the line length, not
+ * encoded again; fmt shall be base64.
+ *
+ * The optional `charset` key names the charset of the payload (see
+ * charset_find): it is transcoded to UTF-8, as Content-Type declares, before
+ * the transfer encoding; utf-8, thus no transcoding, by default.
+ *
+ * The optional `compress` key, whose only value is `gzip`, has an attachment
+ * compressed on the fly before the transfer encoding, that shall be base64;
+ * Content-Type becomes GZ_MIME and GZ_SUFFIX is appended to the filename.
+ *
+ * If the command has an `inline-size` key, the payload is not read from
+ * `path`: a buffer of `inline-size` bytes is allocated as `data` of the new
+ * attachment and the caller shall fill it with the inline block that follows
+ * the command. If the block has been read already, it is passed as `block`,
+ * of `block_size` bytes: when sizes match, the new attachment takes it over as
+ * `data` instead of allocating; otherwise `block` is left to the caller.
+ */
+extern int att_set_add_by_command(
+    att_set_p, comm_arena_p, int is_body, char* block, size_t block_size
+);
+
 extern void att_set_set_body_index(att_set_p);
-extern int  att_set_print(att_set_p, file_p, char* boundary);
+
+/**
+ * Set the number of threads that print parts of a set at once, each into its
+ * own region of the output; the output does not change. It only applies to
+ * regular output files not in append mode, for sets of at least 1 MB whose
+ * part sizes are known in advance. 1, the default, disables parallel printing.
+ */
+extern void att_set_threads(unsigned int threads);
+
+/**
+ * Get the parts of A ready to be printed: inline payloads are transcoded and
+ * compressed, and `fmt=auto` parts are scanned for their format. It shall be
+ * called before att_set_boundary and att_set_print.
+ */
+extern int att_set_prepare(att_set_p A);
+
+/**
+ * Set `boundary` to ATT_BOUNDARY_SIZE random letters, and a NUL, that occur in
+ * no part of A printed as is (all but base64 ones); a new one is drawn as long
+ * as one does.
+ *
+ * Return:
+ * - OK;
+ * - ILLEGAL_FORMAT, if no boundary is found in ATT_BOUNDARY_TRIES draws;
+ * - ERRNO_SPLIT + errno, on read error.
+ */
+extern int att_set_boundary(att_set_p A, char* boundary);
+
+/** Print A, prepared by att_set_prepare, with a boundary by att_set_boundary */
+extern int att_set_print(att_set_p, file_p, char* boundary);
 
 #endif /* CMC_EML_ATTACHMENT_H_INCLUDED */
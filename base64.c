@@ -1,10 +1,33 @@
 /* Copyright (c) 2025 Mattia Cabrini */
 /* SPDX-License-Identifier: MIT      */
 
+#include "feat.h"
+
 #include "base64.h"
 #include "error.h"
 #include "util.h"
 
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Vector kernels are built with per-function target attributes and selected
+ * at run time, thus the binary still runs on any x86 CPU */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_X86
+#include <immintrin.h>
+#endif
+
+/* Input bytes read per step by the file encoder; it must hold at least one
+ * line at BASE64_MAX_LINE_LENGTH */
+#define BASE64_CHUNK 49152
+
+/* Regular files at least this big are encoded in parallel, if enabled */
+#define BASE64_PAR_MIN_SIZE 8388608L
+
+/* Lines per parallel chunk: about 0.9 MB of input at 76 columns */
+#define BASE64_PAR_LINES 16384
+
 static const char ALPHABET[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
@@ -70,8 +93,450 @@ void base64_test_ALPHABET(void)
 }
 #endif
 
+/*
+ * Encoded output, made up by lines of `line_length` chars separated by
+ * <CR><LF>; each line but the last one encodes `line_in` input bytes.
+ */
+typedef struct base64_out_t
+{
+    struct wbuffer_t W;
+    int              line_length;
+    size_t           line_in;
+    int              started; /* A line has been written: <CR><LF> is due */
+}* base64_out_p;
+
+/* 12 bits to 2 chars: PAIRS[2 * i] and PAIRS[2 * i + 1] encode i */
+static char PAIRS[4096 * 2];
+
+static void base64_encode_scalar(
+    char* dst, const unsigned char* src, size_t n, size_t readable
+);
+
+#ifdef BASE64_X86
+/* Each kernel encodes as many blocks as it can load within `readable` bytes,
+ * then hands the remaining bytes over to base64_encode_scalar */
+static void base64_encode_ssse3(
+    char* dst, const unsigned char* src, size_t n, size_t readable
+);
+static void base64_encode_avx2(
+    char* dst, const unsigned char* src, size_t n, size_t readable
+);
+static void base64_encode_avx512vbmi(
+    char* dst, const unsigned char* src, size_t n, size_t readable
+);
+#endif
+
 static void base64_encode_three(char* dst, char* three, unsigned int size);
 
+/**
+ * Encode `lines` whole lines of `line_length` chars from `src` into `dst`, each
+ * one preceded by <CR><LF> if a line has already been written (`started`).
+ *
+ * Return the number of chars written.
+ */
+static size_t base64_encode_body(
+    char*                dst,
+    const unsigned char* src,
+    size_t               lines,
+    size_t               readable,
+    int                  line_length,
+    int                  started
+);
+
+/** Same as base64_encode_body, with the line size in input bytes */
+static size_t base64_encode_lines(
+    char*                dst,
+    const unsigned char* src,
+    size_t               lines,
+    size_t               readable,
+    size_t               line_in,
+    int                  started
+);
+
+/**
+ * Encode the last `n` bytes of the input, less than a line, with padding.
+ *
+ * Return the number of chars written: 0 if `n` is 0.
+ */
+static size_t base64_encode_last(
+    char* dst, const unsigned char* src, size_t n, int started
+);
+
+static void base64_out_init(base64_out_p O, file_p out, int line_length);
+
+/**
+ * Encode as many whole lines as there are in the `n` bytes at `src`, straight
+ * into the output buffer; *done is set to the number of bytes encoded, a
+ * multiple of `line_in`.
+ *
+ * Return OK, or ERRNO_SPLIT + errno on write error.
+ */
+static int base64_out_body(
+    base64_out_p         O,
+    const unsigned char* src,
+    size_t               n,
+    size_t               readable,
+    size_t*              done
+);
+
+/**
+ * Encode the last `n` bytes (less than a line) of the input, with padding.
+ *
+ * Return OK, or ERRNO_SPLIT + errno on write error.
+ */
+static int base64_out_last(base64_out_p O, const unsigned char* src, size_t n);
+
+/* Re-wrapping of base64 input */
+
+typedef struct base64_wrap_t
+{
+    struct wbuffer_t W;
+    size_t           line_length;
+    size_t           col;   /* Chars in the current line */
+    size_t           chars; /* Chars written, padding included */
+    int              pad;   /* '=' written */
+}* base64_wrap_p;
+
+/** Return the number of leading bytes of `src` in the base64 alphabet */
+static size_t base64_scan_scalar(const unsigned char* src, size_t n);
+
+#ifdef BASE64_X86
+static size_t base64_scan_sse2(const unsigned char* src, size_t n);
+static size_t base64_scan_avx2(const unsigned char* src, size_t n);
+#endif
+
+static void base64_wrap_init(base64_wrap_p P, file_p out, int line_length);
+
+/**
+ * Return OK, ILLEGAL_FORMAT if `src` breaks base64 rules or ERRNO_SPLIT + errno
+ * on write error.
+ */
+static int
+base64_wrap_body(base64_wrap_p P, const unsigned char* src, size_t n);
+
+/**
+ * Return OK, ILLEGAL_FORMAT if the input is truncated or ERRNO_SPLIT + errno
+ * on write error.
+ */
+static int base64_wrap_last(base64_wrap_p P);
+
+/**
+ * Write `n` chars, starting new lines as needed.
+ *
+ * Return OK, or ERRNO_SPLIT + errno on write error.
+ */
+static int
+base64_wrap_put(base64_wrap_p P, const unsigned char* src, size_t n);
+
+/* Parallel encoding of a regular file.
+ *
+ * The input is cut into chunks of BASE64_PAR_LINES lines; workers claim chunks
+ * in order, read them by pread, unless the file is mapped, and encode them
+ * into one of `nslots` slots, while the calling thread writes encoded slots in
+ * chunk order. A worker may claim chunk k only once chunk k - nslots has been
+ * written, thus slots are reused without further bookkeeping and memory is
+ * bounded. */
+
+typedef struct base64_slot_t
+{
+    unsigned char* in;
+    char*          out;
+    size_t         out_size;
+    size_t         chunk; /* Chunk held, if ready */
+    int            ready;
+    int            res;
+}* base64_slot_p;
+
+typedef struct base64_par_t
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  cond; /* Broadcast on any change */
+
+    file_p               in;
+    const unsigned char* map; /* The whole of `in`, if mapped; else NULL */
+    off_t                size;
+    int    line_length;
+    size_t line_in;
+    size_t chunk_in; /* Input bytes per chunk; a multiple of line_in */
+    size_t chunks;
+
+    size_t next;    /* Next chunk to claim */
+    size_t written; /* Chunks written so far */
+    int    abort;   /* The writer gave up: workers shall stop */
+
+    base64_slot_p slots;
+    size_t        nslots;
+}* base64_par_p;
+
+/**
+ * Encode `in`, of size `size`, on `threads` workers.
+ *
+ * Return NOT_FOUND, with nothing written, if workers could not be set up: the
+ * caller shall encode serially.
+ */
+static int base64_par_file_to_file(
+    file_p               in,
+    const unsigned char* map,
+    off_t                size,
+    file_p               out,
+    int                  line_length,
+    unsigned int         threads
+);
+
+static void* base64_par_worker(void* arg);
+
+/** Read and encode chunk `chunk` into slot S */
+static int base64_par_encode(base64_par_p P, base64_slot_p S, size_t chunk);
+
+/** Number of threads encoding a single file; 1 disables parallel encoding */
+static unsigned int base64_threads = 1;
+
+/**
+ * Encode `n` bytes from `src` into `n / 3 * 4` chars at `dst`; `n` must be a
+ * multiple of 3. The kernel may load up to `readable` bytes from `src`, with
+ * `readable >= n`.
+ *
+ * Set by base64_init to the fastest kernel the CPU supports.
+ */
+static void (*base64_encode)(
+    char* dst, const unsigned char* src, size_t n, size_t readable
+) = base64_encode_scalar;
+
+/** Set by base64_init to the fastest scanner the CPU supports */
+static size_t (*base64_scan)(const unsigned char* src, size_t n) =
+    base64_scan_scalar;
+
+void base64_init(void)
+{
+    size_t i;
+
+    for (i = 0; i < 4096; ++i)
+    {
+        PAIRS[2 * i]     = ALPHABET[i >> 6];
+        PAIRS[2 * i + 1] = ALPHABET[i & 0x3F];
+    }
+
+#ifdef BASE64_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512vbmi"))
+        base64_encode = base64_encode_avx512vbmi;
+    else if (__builtin_cpu_supports("avx2"))
+        base64_encode = base64_encode_avx2;
+    else if (__builtin_cpu_supports("ssse3"))
+        base64_encode = base64_encode_ssse3;
+
+    if (__builtin_cpu_supports("avx2"))
+        base64_scan = base64_scan_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        base64_scan = base64_scan_sse2;
+#endif
+}
+
+static void base64_encode_scalar(
+    char* dst, const unsigned char* src, size_t n, size_t readable
+)
+{
+    unsigned long t;
+
+    (void)readable;
+
+    for (; n >= 3; n -= 3)
+    {
+        t = (unsigned long)src[0] << 16 | (unsigned long)src[1] << 8 |
+            (unsigned long)src[2];
+
+        memcpy(dst, PAIRS + 2 * (t >> 12), 2);
+        memcpy(dst + 2, PAIRS + 2 * (t & 0xFFF), 2);
+
+        src += 3;
+        dst += 4;
+    }
+}
+
+#ifdef BASE64_X86
+/*
+ * SSSE3 and AVX2 kernels follow W. Mula and D. Lemire, "Faster Base64 Encoding
+ * and Decoding Using AVX2 Instructions" (2018): each 32 bits lane gets 3 input
+ * bytes, that are split into four 6 bits indices by two multiplications; then
+ * indices are translated into ASCII by adding an offset picked by pshufb.
+ */
+
+__attribute__((target("ssse3"))) static __m128i
+base64_split_ssse3(__m128i in)
+{
+    __m128i t0;
+    __m128i t1;
+
+    in = _mm_shuffle_epi8(
+        in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1)
+    );
+
+    t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+    t0 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+
+    t1 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+    t1 = _mm_mullo_epi16(t1, _mm_set1_epi32(0x01000010));
+
+    return _mm_or_si128(t0, t1);
+}
+
+__attribute__((target("ssse3"))) static __m128i
+base64_lookup_ssse3(__m128i idx)
+{
+    __m128i off;
+    __m128i less;
+
+    /* 0 for [26; 51], 1..10 for digits, 11 for '+', 12 for '/', 13 for A-Z */
+    off  = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+    off  = _mm_or_si128(off, _mm_and_si128(less, _mm_set1_epi8(13)));
+
+    /* clang-format off */
+    off  = _mm_shuffle_epi8(_mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0
+    ), off);
+    /* clang-format on */
+
+    return _mm_add_epi8(idx, off);
+}
+
+__attribute__((target("ssse3"))) static void base64_encode_ssse3(
+    char* dst, const unsigned char* src, size_t n, size_t readable
+)
+{
+    __m128i v;
+
+    /* 12 bytes are encoded out of 16 loaded */
+    for (; n >= 12 && readable >= 16; readable -= 12)
+    {
+        v = _mm_loadu_si128((const __m128i*)(const void*)src);
+        v = base64_lookup_ssse3(base64_split_ssse3(v));
+        _mm_storeu_si128((__m128i*)(void*)dst, v);
+
+        src += 12;
+        dst += 16;
+        n -= 12;
+    }
+
+    base64_encode_scalar(dst, src, n, readable);
+}
+
+__attribute__((target("avx2"))) static void base64_encode_avx2(
+    char* dst, const unsigned char* src, size_t n, size_t readable
+)
+{
+    __m256i v;
+    __m256i t0;
+    __m256i t1;
+    __m256i off;
+    __m256i less;
+
+    /* 24 bytes are encoded: 12 out of 16 loaded per 128 bits lane */
+    for (; n >= 24 && readable >= 28; readable -= 24)
+    {
+        v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(
+                _mm_loadu_si128((const __m128i*)(const void*)src)
+            ),
+            _mm_loadu_si128((const __m128i*)(const void*)(src + 12)),
+            1
+        );
+
+        /* clang-format off */
+        v = _mm256_shuffle_epi8(v, _mm256_set_epi8(
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1
+        ));
+        /* clang-format on */
+
+        t0   = _mm256_and_si256(v, _mm256_set1_epi32(0x0FC0FC00));
+        t0   = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        t1   = _mm256_and_si256(v, _mm256_set1_epi32(0x003F03F0));
+        t1   = _mm256_mullo_epi16(t1, _mm256_set1_epi32(0x01000010));
+        v    = _mm256_or_si256(t0, t1);
+
+        off  = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+        less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), v);
+        less = _mm256_and_si256(less, _mm256_set1_epi8(13));
+        off  = _mm256_or_si256(off, less);
+        /* clang-format off */
+        off  = _mm256_shuffle_epi8(_mm256_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0
+        ), off);
+        /* clang-format on */
+
+        _mm256_storeu_si256(
+            (__m256i*)(void*)dst, _mm256_add_epi8(v, off)
+        );
+
+        src += 24;
+        dst += 32;
+        n -= 24;
+    }
+
+    base64_encode_scalar(dst, src, n, readable);
+}
+
+/*
+ * AVX-512VBMI: vpermb spreads 48 input bytes over 16 lanes of 4 bytes (as
+ * above); vpmultishiftqb extracts the 6 bits indices, in the low bits of each
+ * byte; a second vpermb looks them up in the alphabet, ignoring the top bits.
+ */
+__attribute__((target("avx512vbmi,avx512bw,avx512f"))) static void
+base64_encode_avx512vbmi(
+    char* dst, const unsigned char* src, size_t n, size_t readable
+)
+{
+    __m512i v;
+    __m512i spread;
+    __m512i shifts;
+    __m512i alphabet;
+
+    /* clang-format off */
+    spread = _mm512_setr_epi32(
+        0x01020001, 0x04050304, 0x07080607, 0x0A0B090A,
+        0x0D0E0C0D, 0x10110F10, 0x13141213, 0x16171516,
+        0x191A1819, 0x1C1D1B1C, 0x1F201E1F, 0x22232122,
+        0x25262425, 0x28292728, 0x2B2C2A2B, 0x2E2F2D2E
+    );
+
+    /* Bit offsets 10, 4, 22, 16 of the lower 32 bits, then 42, 36, 54, 48 */
+    shifts = _mm512_setr_epi32(
+        0x1016040A, 0x3036242A, 0x1016040A, 0x3036242A,
+        0x1016040A, 0x3036242A, 0x1016040A, 0x3036242A,
+        0x1016040A, 0x3036242A, 0x1016040A, 0x3036242A,
+        0x1016040A, 0x3036242A, 0x1016040A, 0x3036242A
+    );
+    /* clang-format on */
+
+    alphabet = _mm512_loadu_si512((const void*)ALPHABET);
+
+    /* 48 bytes are encoded out of 64 loaded */
+    for (; n >= 48 && readable >= 64; readable -= 48)
+    {
+        v = _mm512_loadu_si512((const void*)src);
+        v = _mm512_permutexvar_epi8(spread, v);
+        v = _mm512_multishift_epi64_epi8(shifts, v);
+        v = _mm512_permutexvar_epi8(v, alphabet);
+        _mm512_storeu_si512((void*)dst, v);
+
+        src += 48;
+        dst += 64;
+        n -= 48;
+    }
+
+    base64_encode_scalar(dst, src, n, readable);
+}
+#endif
+
 static void base64_encode_three(char* dst, char* three, unsigned int size)
 {
     int n6 = 0;
@@ -106,60 +571,763 @@ static void base64_encode_three(char* dst, char* three, unsigned int size)
     }
 }
 
-int base64_file_to_file(file_p in, file_p out, int line_length)
+void base64_set_threads(unsigned int threads)
+{
+    base64_threads = threads > 0 ? threads : 1;
+}
+
+static size_t base64_encode_body(
+    char*                dst,
+    const unsigned char* src,
+    size_t               lines,
+    size_t               readable,
+    int                  line_length,
+    int                  started
+)
+{
+    /* Constant line sizes let the compiler specialise the common cases */
+    switch (line_length)
+    {
+    case 76:
+        return base64_encode_lines(dst, src, lines, readable, 57, started);
+    case 64:
+        return base64_encode_lines(dst, src, lines, readable, 48, started);
+    default:
+        return base64_encode_lines(
+            dst, src, lines, readable, (size_t)line_length / 4 * 3, started
+        );
+    }
+}
+
+static size_t base64_encode_lines(
+    char*                dst,
+    const unsigned char* src,
+    size_t               lines,
+    size_t               readable,
+    size_t               line_in,
+    int                  started
+)
 {
-    char buf[4];
-    char three[3]         = {0};
+    char*  o_dst    = dst;
+    size_t line_out = line_in / 3 * 4;
 
-    ssize_t rw_bytes      = 0;
-    int     current_ll    = 0;
-    int     to_print_part = 0;
+    for (; lines > 0; --lines)
+    {
+        if (started)
+        {
+            dst[0] = '\r';
+            dst[1] = '\n';
+            dst += 2;
+        }
 
-    struct rbuffer_t file_in;
-    struct wbuffer_t file_out;
+        base64_encode(dst, src, line_in, readable);
 
-    int res;
+        dst += line_out;
+        src += line_in;
+        readable -= line_in;
+        started = 1;
+    }
 
+    return (size_t)(dst - o_dst);
+}
+
+static size_t base64_encode_last(
+    char* dst, const unsigned char* src, size_t n, int started
+)
+{
+    size_t whole    = n - n % 3;
+    char   three[3] = {0};
+    char*  o_dst    = dst;
+
+    if (n == 0)
+        return 0;
+
+    if (started)
+    {
+        dst[0] = '\r';
+        dst[1] = '\n';
+        dst += 2;
+    }
+
+    base64_encode(dst, src, whole, n);
+    dst += whole / 3 * 4;
+
+    if (whole < n)
+    {
+        memcpy(three, src + whole, n - whole);
+        base64_encode_three(dst, three, (unsigned int)(n - whole));
+        dst += 4;
+    }
+
+    return (size_t)(dst - o_dst);
+}
+
+static void base64_out_init(base64_out_p O, file_p out, int line_length)
+{
     assert(
-        line_length >= 4,
+        line_length >= 4 && line_length <= BASE64_MAX_LINE_LENGTH &&
+            line_length % 4 == 0,
         FATAL_LOGIC,
-        "base64_file_to_file: line_length too small"
+        "base64_out_init: invalid line_length"
+    );
+
+    wbuffer_init(&O->W, out);
+    O->line_length = line_length;
+    O->line_in     = (size_t)line_length / 4 * 3;
+    O->started     = 0;
+}
+
+static int base64_out_body(
+    base64_out_p         O,
+    const unsigned char* src,
+    size_t               n,
+    size_t               readable,
+    size_t*              done
+)
+{
+    size_t lines    = n / O->line_in;
+    size_t line_out = (size_t)O->line_length + 2; /* <CR><LF> included */
+    size_t fit;
+    char*  dst;
+    int    res;
+
+    *done = 0;
+
+    /* As many lines as fit in the output buffer per call */
+    while (lines > 0)
+    {
+        res = wbuffer_room(&O->W, line_out, &dst);
+        return_iferr(res);
+
+        fit = (sizeof(O->W.buffer) - O->W.cur) / line_out;
+        if (fit > lines)
+            fit = lines;
+
+        O->W.cur += base64_encode_body(
+            dst, src + *done, fit, readable - *done, O->line_length, O->started
+        );
+
+        O->started = 1;
+        *done += fit * O->line_in;
+        lines -= fit;
+    }
+
+    return OK;
+}
+
+static int base64_out_last(base64_out_p O, const unsigned char* src, size_t n)
+{
+    char* dst;
+    int   res;
+
+    if (n == 0)
+        return OK;
+
+    res = wbuffer_room(&O->W, n / 3 * 4 + 4 + 2, &dst);
+    return_iferr(res);
+
+    O->W.cur += base64_encode_last(dst, src, n, O->started);
+    O->started = 1;
+
+    return OK;
+}
+
+static int base64_par_file_to_file(
+    file_p               in,
+    const unsigned char* map,
+    off_t                size,
+    file_p               out,
+    int                  line_length,
+    unsigned int         threads
+)
+{
+    struct base64_par_t P;
+    pthread_t*          workers;
+    unsigned int        nworkers;
+    size_t              i;
+    base64_slot_p       S;
+    int                 res = OK;
+
+    P.in          = in;
+    P.map         = map;
+    P.size        = size;
+    P.line_length = line_length;
+    P.line_in     = (size_t)line_length / 4 * 3;
+    P.chunk_in    = P.line_in * BASE64_PAR_LINES;
+    P.chunks      = ((size_t)size + P.chunk_in - 1) / P.chunk_in;
+    P.next        = 0;
+    P.written     = 0;
+    P.abort       = 0;
+    P.nslots      = 2 * (size_t)threads;
+
+    workers       = malloc(threads * sizeof(pthread_t));
+    P.slots       = calloc(P.nslots, sizeof(struct base64_slot_t));
+
+    for (i = 0; P.slots != NULL && i < P.nslots; ++i)
+    {
+        /* The last line of the file may need 4 more chars for padding */
+        P.slots[i].in  = map == NULL ? malloc(P.chunk_in) : NULL;
+        P.slots[i].out = malloc(P.chunk_in / 3 * 4 + 2 * BASE64_PAR_LINES + 4);
+
+        if ((map == NULL && P.slots[i].in == NULL) || P.slots[i].out == NULL)
+            res = NOT_FOUND;
+    }
+
+    if (workers == NULL || P.slots == NULL)
+        res = NOT_FOUND;
+
+    if (res == OK)
+    {
+        pthread_mutex_init(&P.lock, NULL);
+        pthread_cond_init(&P.cond, NULL);
+
+        for (nworkers = 0; nworkers < threads; ++nworkers)
+        {
+            res = pthread_create(
+                workers + nworkers, NULL, base64_par_worker, &P
+            );
+            if (res != 0)
+                break;
+        }
+
+        /* Fewer workers than requested are fine, as long as there is one */
+        res = nworkers > 0 ? OK : NOT_FOUND;
+
+        /* Chunks are written in order, as soon as they are encoded */
+        for (i = 0; res == OK && i < P.chunks; ++i)
+        {
+            S = P.slots + i % P.nslots;
+
+            pthread_mutex_lock(&P.lock);
+            while (!S->ready || S->chunk != i)
+                pthread_cond_wait(&P.cond, &P.lock);
+            pthread_mutex_unlock(&P.lock);
+
+            res = S->res;
+            if (res == OK)
+                res = file_write(out, S->out, S->out_size);
+
+            pthread_mutex_lock(&P.lock);
+            S->ready  = 0;
+            P.written = i + 1;
+            pthread_cond_broadcast(&P.cond);
+            pthread_mutex_unlock(&P.lock);
+        }
+
+        pthread_mutex_lock(&P.lock);
+        P.abort = 1;
+        pthread_cond_broadcast(&P.cond);
+        pthread_mutex_unlock(&P.lock);
+
+        for (; nworkers > 0; --nworkers)
+            pthread_join(workers[nworkers - 1], NULL);
+
+        pthread_cond_destroy(&P.cond);
+        pthread_mutex_destroy(&P.lock);
+    }
+
+    for (i = 0; P.slots != NULL && i < P.nslots; ++i)
+    {
+        free(P.slots[i].in);
+        free(P.slots[i].out);
+    }
+
+    free(P.slots);
+    free(workers);
+
+    switch (res)
+    {
+    case OK:
+    case NOT_FOUND:
+        break;
+    case ILLEGAL_FORMAT:
+        strncpy(
+            error_message,
+            "base64_file_to_file: file shrunk while encoding",
+            MAX_ERROR_SIZE
+        );
+        break;
+    default:
+        strncpy(error_message, "base64_file_to_file", MAX_ERROR_SIZE);
+    }
+
+    return res;
+}
+
+static void* base64_par_worker(void* arg)
+{
+    base64_par_p  P = arg;
+    base64_slot_p S;
+    size_t        chunk;
+    int           res;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&P->lock);
+
+        while (!P->abort && P->next < P->chunks &&
+               P->next >= P->written + P->nslots)
+            pthread_cond_wait(&P->cond, &P->lock);
+
+        if (P->abort || P->next >= P->chunks)
+        {
+            pthread_mutex_unlock(&P->lock);
+            return NULL;
+        }
+
+        chunk = P->next++;
+        pthread_mutex_unlock(&P->lock);
+
+        S   = P->slots + chunk % P->nslots;
+        res = base64_par_encode(P, S, chunk);
+
+        pthread_mutex_lock(&P->lock);
+        S->res   = res;
+        S->chunk = chunk;
+        S->ready = 1;
+        pthread_cond_broadcast(&P->cond);
+        pthread_mutex_unlock(&P->lock);
+    }
+}
+
+static int base64_par_encode(base64_par_p P, base64_slot_p S, size_t chunk)
+{
+    off_t                off = (off_t)(chunk * P->chunk_in);
+    size_t               n   = P->chunk_in;
+    size_t               readable;
+    size_t               got;
+    size_t               lines;
+    ssize_t              rb;
+    const unsigned char* src;
+
+    if ((off_t)n > P->size - off)
+        n = (size_t)(P->size - off);
+
+    if (P->map != NULL)
+    {
+        src      = P->map + off;
+        readable = (size_t)(P->size - off);
+    }
+    else
+    {
+        for (got = 0; got < n; got += (size_t)rb)
+        {
+            rb = file_pread(
+                P->in, (char*)S->in + got, n - got, off + (off_t)got
+            );
+
+            if (rb < 0)
+                return ERRNO_SPLIT + errno;
+
+            if (rb == 0)
+                return ILLEGAL_FORMAT;
+        }
+
+        src      = S->in;
+        readable = n;
+    }
+
+    lines       = n / P->line_in;
+    S->out_size = base64_encode_body(
+        S->out, src, lines, readable, P->line_length, chunk > 0
     );
 
-    rbuffer_init(&file_in, in);
-    wbuffer_init(&file_out, out);
+    S->out_size += base64_encode_last(
+        S->out + S->out_size,
+        src + lines * P->line_in,
+        n - lines * P->line_in,
+        chunk > 0 || lines > 0
+    );
+
+    return OK;
+}
+
+int base64_file_to_file(file_p in, file_p out, int line_length)
+{
+    unsigned char src[BASE64_CHUNK];
+    size_t        n = 0; /* Bytes in src */
+    size_t        done;
+    ssize_t       rb = 0;
+    off_t         size;
+    const char*   map;
+    size_t        map_size;
+
+    struct base64_out_t file_out;
+
+    int res;
+
+    base64_out_init(&file_out, out, line_length);
+
+    /* A mapped file is encoded in place, as one span: no read, no copy */
+    if (file_map(in, &map, &map_size) == OK)
+    {
+        res = NOT_FOUND;
+        if (base64_threads > 1 && map_size >= BASE64_PAR_MIN_SIZE)
+            res = base64_par_file_to_file(
+                in,
+                (const unsigned char*)map,
+                (off_t)map_size,
+                out,
+                line_length,
+                base64_threads
+            );
+
+        if (res == NOT_FOUND)
+            res = base64_buf_to_file(map, map_size, out, line_length);
+
+        file_unmap(map, map_size);
+
+        return res;
+    }
 
     if (file_isreg(in))
     {
+        size = file_size(in);
+
+        if (base64_threads > 1 && size >= BASE64_PAR_MIN_SIZE)
+        {
+            res = base64_par_file_to_file(
+                in, NULL, size, out, line_length, base64_threads
+            );
+
+            if (res != NOT_FOUND)
+                return res;
+        }
+
         res = file_seek(in, 0, SEEK_SET);
-        assert(res == OK, res, "base64_file_to_file: seek set");
+        if (res != OK)
+        {
+            strncpy(
+                error_message, "base64_file_to_file: seek set", MAX_ERROR_SIZE
+            );
+            return res;
+        }
     }
 
-    while ((rw_bytes = rbuffer_read(&file_in, three, sizeof(three))) > 0)
+    do
     {
-        base64_encode_three(buf, three, (unsigned int)rw_bytes);
+        /* Fill src up: only the last line may be shorter than line_in */
+        for (; n < sizeof(src); n += (size_t)rb)
+        {
+            rb = file_read(in, (char*)src + n, sizeof(src) - n);
+            if (rb <= 0)
+                break;
+        }
 
-        if (current_ll + 4 > line_length)
+        if (rb < 0)
         {
-            to_print_part = (size_t)(line_length - current_ll);
+            strncpy(error_message, "base64_file_to_file: read", MAX_ERROR_SIZE);
+            return ERRNO_SPLIT + errno;
+        }
+
+        res = base64_out_body(&file_out, src, n, n, &done);
+        return_iferr(res);
+
+        memmove(src, src + done, n - done);
+        n -= done;
+    } while (rb > 0);
+
+    res = base64_out_last(&file_out, src, n);
+    return_iferr(res);
+
+    return wbuffer_flush(&file_out.W);
+}
+
+int base64_buf_to_file(const char* in, size_t sz, file_p out, int line_length)
+{
+    const unsigned char* src = (const unsigned char*)in;
+    size_t               done;
+    int                  res;
+
+    struct base64_out_t file_out;
+
+    base64_out_init(&file_out, out, line_length);
+
+    res = base64_out_body(&file_out, src, sz, sz, &done);
+    if (res == OK)
+        res = base64_out_last(&file_out, src + done, sz - done);
+    if (res == OK)
+        res = wbuffer_flush(&file_out.W);
+
+    return res;
+}
+
+off_t base64_encoded_size(off_t n, int line_length)
+{
+    off_t chars;
+    off_t lines;
+
+    if (n == 0)
+        return 0;
+
+    chars = (n + 2) / 3 * 4;
+    lines = (chars + line_length - 1) / line_length;
+
+    /* <CR><LF> between lines, not after the last one */
+    return chars + 2 * (lines - 1);
+}
+
+static size_t base64_scan_scalar(const unsigned char* src, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        if (!((src[i] >= 'A' && src[i] <= 'Z') ||
+              (src[i] >= 'a' && src[i] <= 'z') ||
+              (src[i] >= '0' && src[i] <= '9') || src[i] == '+' ||
+              src[i] == '/'))
+            break;
+
+    return i;
+}
+
+#ifdef BASE64_X86
+/* Bytes are compared as signed: those above 127 are negative, thus out of any
+ * range of the alphabet */
+
+__attribute__((target("sse2"))) static __m128i
+base64_range_sse2(__m128i v, char lo, char hi)
+{
+    return _mm_and_si128(
+        _mm_cmpgt_epi8(v, _mm_set1_epi8((char)(lo - 1))),
+        _mm_cmplt_epi8(v, _mm_set1_epi8((char)(hi + 1)))
+    );
+}
+
+__attribute__((target("sse2"))) static size_t
+base64_scan_sse2(const unsigned char* src, size_t n)
+{
+    __m128i      v;
+    __m128i      ok;
+    unsigned int bad;
+    size_t       i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        v  = _mm_loadu_si128((const __m128i*)(const void*)(src + i));
+        ok = _mm_or_si128(
+            base64_range_sse2(v, 'A', 'Z'), base64_range_sse2(v, 'a', 'z')
+        );
+        ok = _mm_or_si128(ok, base64_range_sse2(v, '0', '9'));
+        ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('+')));
+        ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+
+        bad = (unsigned int)_mm_movemask_epi8(ok) ^ 0xFFFFu;
+        if (bad != 0)
+            return i + (size_t)__builtin_ctz(bad);
+    }
+
+    return i + base64_scan_scalar(src + i, n - i);
+}
+
+__attribute__((target("avx2"))) static __m256i
+base64_range_avx2(__m256i v, char lo, char hi)
+{
+    return _mm256_and_si256(
+        _mm256_cmpgt_epi8(v, _mm256_set1_epi8((char)(lo - 1))),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(hi + 1)), v)
+    );
+}
+
+__attribute__((target("avx2"))) static size_t
+base64_scan_avx2(const unsigned char* src, size_t n)
+{
+    __m256i      v;
+    __m256i      ok;
+    unsigned int bad;
+    size_t       i;
 
-            if (to_print_part > 0)
-                wbuffer_put(&file_out, buf, (size_t)to_print_part);
+    for (i = 0; i + 32 <= n; i += 32)
+    {
+        v  = _mm256_loadu_si256((const __m256i*)(const void*)(src + i));
+        ok = _mm256_or_si256(
+            base64_range_avx2(v, 'A', 'Z'), base64_range_avx2(v, 'a', 'z')
+        );
+        ok = _mm256_or_si256(ok, base64_range_avx2(v, '0', '9'));
+        ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('+')));
+        ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+
+        bad = ~(unsigned int)_mm256_movemask_epi8(ok);
+        if (bad != 0)
+            return i + (size_t)__builtin_ctz(bad);
+    }
+
+    return i + base64_scan_sse2(src + i, n - i);
+}
+#endif
 
-            current_ll = (int)sizeof(buf) - to_print_part;
-            wbuffer_put(&file_out, "\r\n", 2 * sizeof(char));
-            wbuffer_put(&file_out, buf + to_print_part, (size_t)current_ll);
+static void base64_wrap_init(base64_wrap_p P, file_p out, int line_length)
+{
+    assert(
+        line_length >= 4 && line_length <= BASE64_MAX_LINE_LENGTH &&
+            line_length % 4 == 0,
+        FATAL_LOGIC,
+        "base64_wrap_init: invalid line_length"
+    );
+
+    wbuffer_init(&P->W, out);
+    P->line_length = (size_t)line_length;
+    P->col         = 0;
+    P->chars       = 0;
+    P->pad         = 0;
+}
+
+static int base64_wrap_body(base64_wrap_p P, const unsigned char* src, size_t n)
+{
+    size_t i = 0;
+    size_t run;
+    int    res;
+
+    while (i < n)
+    {
+        /* Nothing but padding may follow padding */
+        if (P->pad == 0)
+        {
+            run = base64_scan(src + i, n - i);
+            if (run > 0)
+            {
+                res = base64_wrap_put(P, src + i, run);
+                return_iferr(res);
+                i += run;
+                continue;
+            }
         }
-        else
+
+        switch (src[i])
         {
-            wbuffer_put(&file_out, buf, sizeof(buf));
-            current_ll += 4;
+        case '\r':
+        case '\n':
+        case ' ':
+        case '\t':
+            break;
+        case '=':
+            if (++P->pad > 2)
+                return ILLEGAL_FORMAT;
+
+            res = base64_wrap_put(P, src + i, 1);
+            return_iferr(res);
+            break;
+        default:
+            return ILLEGAL_FORMAT;
         }
 
-        three[0] = three[1] = three[2] = '\0';
+        ++i;
     }
 
-    wbuffer_flush(&file_out);
+    return OK;
+}
+
+static int base64_wrap_last(base64_wrap_p P)
+{
+    int res;
+
+    res = wbuffer_flush(&P->W);
+    return_iferr(res);
+
+    return P->chars % 4 == 0 ? OK : ILLEGAL_FORMAT;
+}
+
+static int base64_wrap_put(base64_wrap_p P, const unsigned char* src, size_t n)
+{
+    size_t fit;
+    char*  dst;
+    int    res;
+
+    P->chars += n;
+
+    while (n > 0)
+    {
+        /* <CR><LF> goes before each line but the first */
+        if (P->col == P->line_length)
+        {
+            res = wbuffer_room(&P->W, 2, &dst);
+            return_iferr(res);
+
+            memcpy(dst, "\r\n", 2);
+            P->W.cur += 2;
+            P->col = 0;
+        }
+
+        fit = P->line_length - P->col;
+        if (fit > n)
+            fit = n;
+
+        res = wbuffer_room(&P->W, fit, &dst);
+        return_iferr(res);
+
+        memcpy(dst, src, fit);
+        P->W.cur += fit;
+        P->col += fit;
+
+        src += fit;
+        n -= fit;
+    }
 
     return OK;
 }
+
+int base64_rewrap_file(file_p in, file_p out, int line_length)
+{
+    unsigned char src[BASE64_CHUNK];
+    ssize_t       rb;
+    int           res = OK;
+
+    struct base64_wrap_t wrap;
+
+    base64_wrap_init(&wrap, out, line_length);
+
+    if (file_isreg(in))
+    {
+        res = file_seek(in, 0, SEEK_SET);
+        if (res != OK)
+        {
+            strncpy(
+                error_message, "base64_rewrap_file: seek set", MAX_ERROR_SIZE
+            );
+            return res;
+        }
+    }
+
+    while (res == OK && (rb = file_read(in, (char*)src, sizeof(src))) > 0)
+        res = base64_wrap_body(&wrap, src, (size_t)rb);
+
+    if (res == OK && rb < 0)
+    {
+        strncpy(error_message, "base64_rewrap_file: read", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + errno;
+    }
+
+    if (res == OK)
+        res = base64_wrap_last(&wrap);
+
+    if (res == ILLEGAL_FORMAT)
+        strncpy(
+            error_message,
+            "base64_rewrap_file: invalid base64 input",
+            MAX_ERROR_SIZE
+        );
+
+    return res;
+}
+
+int base64_rewrap_buf(const char* in, size_t sz, file_p out, int line_length)
+{
+    int res;
+
+    struct base64_wrap_t wrap;
+
+    base64_wrap_init(&wrap, out, line_length);
+
+    res = base64_wrap_body(&wrap, (const unsigned char*)in, sz);
+    if (res == OK)
+        res = base64_wrap_last(&wrap);
+
+    if (res == ILLEGAL_FORMAT)
+        strncpy(
+            error_message,
+            "base64_rewrap_buf: invalid base64 input",
+            MAX_ERROR_SIZE
+        );
+
+    return res;
+}
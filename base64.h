@@ -6,8 +6,70 @@
 
 #include "io.h"
 
+/* RFC 2045 */
+#define BASE64_LINE_LENGTH 76
+
+/* RFC 5322 line limit, rounded down to a multiple of 4 */
+#define BASE64_MAX_LINE_LENGTH 996
+
+/**
+ * Build the encoding tables and select the fastest encoder the CPU supports
+ * (AVX-512VBMI, AVX2 or SSSE3 on x86, scalar otherwise); the output is the same
+ * in any case.
+ *
+ * It must be called once, at startup, before any encoding.
+ */
+extern void base64_init(void);
+
+/**
+ * Set the number of threads that encode a single regular file of at least 8 MB
+ * (BASE64_PAR_MIN_SIZE), in line-aligned chunks written in order; the output
+ * does not change. 1, the default, disables parallel encoding.
+ */
+extern void base64_set_threads(unsigned int threads);
+
+/**
+ * Encode `in`, from its beginning if it is a regular file, into `out`; a
+ * regular file is mapped (file_map) and encoded in place, anything else is
+ * read.
+ *
+ * The output is made up by lines of `line_length` chars, separated by
+ * <CR><LF>; the last line may be shorter and is not followed by <CR><LF>.
+ * `line_length` must be a multiple of 4 in range [4; BASE64_MAX_LINE_LENGTH].
+ *
+ * Return:
+ * - OK;
+ * - ERRNO_SPLIT + errno, on read or write error.
+ */
 extern int base64_file_to_file(file_p in, file_p out, int line_length);
 
+/** Same as base64_file_to_file, but the input is the `sz` bytes at `in` */
+extern int
+base64_buf_to_file(const char* in, size_t sz, file_p out, int line_length);
+
+/**
+ * Copy `in`, from its beginning if it is a regular file, that is already
+ * base64 encoded, into `out`, wrapped as base64_file_to_file would wrap it.
+ *
+ * Whitespace (<CR>, <LF>, space and tab) in the input is dropped; anything
+ * else must be in the base64 alphabet, followed by up to 2 '=' of padding,
+ * for a multiple of 4 chars in total.
+ *
+ * Return:
+ * - OK;
+ * - ILLEGAL_FORMAT, if the input is not valid base64 (some output may have
+ *   been written already);
+ * - ERRNO_SPLIT + errno, on read or write error.
+ */
+extern int base64_rewrap_file(file_p in, file_p out, int line_length);
+
+/** Same as base64_rewrap_file, but the input is the `sz` bytes at `in` */
+extern int
+base64_rewrap_buf(const char* in, size_t sz, file_p out, int line_length);
+
+/** Size of the output of base64_file_to_file for an input of `n` bytes */
+extern off_t base64_encoded_size(off_t n, int line_length);
+
 #ifdef DEBUG
 extern void base64_test_ALPHABET(void);
 #endif
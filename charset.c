@@ -0,0 +1,227 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#include "feat.h"
+
+#include "charset.h"
+#include "error.h"
+
+#include <string.h>
+#include <strings.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHARSET_X86
+#include <immintrin.h>
+#endif
+
+static const struct
+{
+    const char* name;
+    int         charset;
+} CHARSET_NAMES[] = {
+    {"utf-8", CHARSET_UTF8},
+    {"utf8", CHARSET_UTF8},
+    {"iso-8859-1", CHARSET_LATIN1},
+    {"latin1", CHARSET_LATIN1},
+    {"windows-1252", CHARSET_CP1252},
+    {"cp1252", CHARSET_CP1252},
+};
+
+/* Windows-1252 code points of bytes 0x80 to 0x9F; the 5 bytes left undefined
+ * keep the Latin-1 (C1 control) code point, as browsers do */
+static const unsigned short CP1252_HIGH[32] = {
+    0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+    0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178
+};
+
+/** Return the number of leading ASCII bytes of `src` */
+static size_t charset_ascii_scalar(const unsigned char* src, size_t n);
+
+#ifdef CHARSET_X86
+static size_t charset_ascii_sse2(const unsigned char* src, size_t n);
+static size_t charset_ascii_avx2(const unsigned char* src, size_t n);
+#endif
+
+/** Set by charset_init to the fastest scanner the CPU supports */
+static size_t (*charset_ascii)(const unsigned char* src, size_t n) =
+    charset_ascii_scalar;
+
+/** Code point of the byte `c`, above 127 */
+static unsigned int charset_code_point(int charset, unsigned char c);
+
+void charset_init(void)
+{
+#ifdef CHARSET_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        charset_ascii = charset_ascii_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        charset_ascii = charset_ascii_sse2;
+#endif
+}
+
+int charset_find(const char* name, int* charset)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(CHARSET_NAMES) / sizeof(*CHARSET_NAMES); ++i)
+        if (strcasecmp(name, CHARSET_NAMES[i].name) == 0)
+        {
+            *charset = CHARSET_NAMES[i].charset;
+            return OK;
+        }
+
+    return NOT_FOUND;
+}
+
+static size_t charset_ascii_scalar(const unsigned char* src, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        if (src[i] > 127)
+            break;
+
+    return i;
+}
+
+#ifdef CHARSET_X86
+/* Bytes above 127 are those whose sign bit is set */
+
+__attribute__((target("sse2"))) static size_t
+charset_ascii_sse2(const unsigned char* src, size_t n)
+{
+    unsigned int high;
+    size_t       i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        high = (unsigned int)_mm_movemask_epi8(
+            _mm_loadu_si128((const __m128i*)(const void*)(src + i))
+        );
+        if (high != 0)
+            return i + (size_t)__builtin_ctz(high);
+    }
+
+    return i + charset_ascii_scalar(src + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+charset_ascii_avx2(const unsigned char* src, size_t n)
+{
+    unsigned int high;
+    size_t       i;
+
+    for (i = 0; i + 32 <= n; i += 32)
+    {
+        high = (unsigned int)_mm256_movemask_epi8(
+            _mm256_loadu_si256((const __m256i*)(const void*)(src + i))
+        );
+        if (high != 0)
+            return i + (size_t)__builtin_ctz(high);
+    }
+
+    return i + charset_ascii_sse2(src + i, n - i);
+}
+#endif
+
+static unsigned int charset_code_point(int charset, unsigned char c)
+{
+    if (charset == CHARSET_CP1252 && c < 0xA0)
+        return CP1252_HIGH[c - 0x80];
+
+    return c;
+}
+
+size_t charset_utf8_size(int charset, const char* src, size_t n)
+{
+    const unsigned char* s    = (const unsigned char*)src;
+    size_t               size = n;
+    size_t               i    = 0;
+
+    if (charset == CHARSET_UTF8)
+        return n;
+
+    for (;;)
+    {
+        i += charset_ascii(s + i, n - i);
+        if (i == n)
+            break;
+
+        /* Code points above 127 take 2 bytes, 3 from U+0800 on */
+        size += charset_code_point(charset, s[i]) < 0x800 ? 1 : 2;
+        ++i;
+    }
+
+    return size;
+}
+
+size_t charset_to_utf8(int charset, char* dst, const char* src, size_t n)
+{
+    const unsigned char* s = (const unsigned char*)src;
+    unsigned char*       d = (unsigned char*)dst;
+    unsigned int         cp;
+    size_t               run;
+    size_t               i = 0;
+
+    if (charset == CHARSET_UTF8)
+    {
+        memmove(dst, src, n);
+        return n;
+    }
+
+    for (;;)
+    {
+        run = charset_ascii(s + i, n - i);
+        memmove(d, s + i, run);
+        d += run;
+        i += run;
+
+        if (i == n)
+            break;
+
+        cp = charset_code_point(charset, s[i++]);
+
+        if (cp < 0x800)
+            *d++ = (unsigned char)(0xC0 | cp >> 6);
+        else
+        {
+            *d++ = (unsigned char)(0xE0 | cp >> 12);
+            *d++ = (unsigned char)(0x80 | (cp >> 6 & 0x3F));
+        }
+
+        *d++ = (unsigned char)(0x80 | (cp & 0x3F));
+    }
+
+    return (size_t)(d - (unsigned char*)dst);
+}
+
+size_t charset_to_utf8_inplace(int charset, char* buf, size_t n, size_t room)
+{
+    size_t ascii;
+    size_t rest;
+
+    assert(
+        room / CHARSET_MAX_GROWTH >= n,
+        FATAL_LOGIC,
+        "charset_to_utf8_inplace: no room"
+    );
+
+    if (charset == CHARSET_UTF8)
+        return n;
+
+    ascii = charset_ascii((const unsigned char*)buf, n);
+    if (ascii == n)
+        return n;
+
+    /* The rest is moved to the end of buf: transcoding it forward never
+     * overwrites bytes not yet read */
+    rest = n - ascii;
+    memmove(buf + room - rest, buf + ascii, rest);
+
+    return ascii +
+           charset_to_utf8(charset, buf + ascii, buf + room - rest, rest);
+}
@@ -0,0 +1,53 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#ifndef CMC_EML_CHARSET_H_INCLUDED
+#define CMC_EML_CHARSET_H_INCLUDED
+
+#include <stddef.h>
+
+/* Charsets of the content, transcoded to UTF-8 */
+#define CHARSET_UTF8 0   /* Nothing to transcode */
+#define CHARSET_LATIN1 1 /* ISO-8859-1 */
+#define CHARSET_CP1252 2 /* Windows-1252 */
+
+/* Bytes of UTF-8 per input byte, at most */
+#define CHARSET_MAX_GROWTH 3
+
+/**
+ * Select the fastest ASCII scanner the CPU supports (AVX2 or SSE2 on x86,
+ * scalar otherwise); the output is the same in any case.
+ *
+ * It must be called once, at startup, before any transcoding.
+ */
+extern void charset_init(void);
+
+/**
+ * Set `charset` to the CHARSET_* named `name` (case insensitive): utf-8,
+ * iso-8859-1 (or latin1) and windows-1252 (or cp1252).
+ *
+ * Return OK or NOT_FOUND.
+ */
+extern int charset_find(const char* name, int* charset);
+
+/** Size of the `n` bytes at `src` once transcoded */
+extern size_t charset_utf8_size(int charset, const char* src, size_t n);
+
+/**
+ * Transcode the `n` bytes at `src` into `dst`, that shall have room for
+ * charset_utf8_size bytes; return the bytes written. `dst` may overlap `src` if
+ * it starts at least 2 * n bytes before it.
+ */
+extern size_t
+charset_to_utf8(int charset, char* dst, const char* src, size_t n);
+
+/**
+ * Transcode the `n` bytes at `buf` in place; `room`, the size of `buf`, shall
+ * be at least CHARSET_MAX_GROWTH * n. Return the bytes of UTF-8 at `buf`.
+ *
+ * Pure ASCII input, the most common, is left where it is.
+ */
+extern size_t
+charset_to_utf8_inplace(int charset, char* buf, size_t n, size_t room);
+
+#endif /* CMC_EML_CHARSET_H_INCLUDED */
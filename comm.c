@@ -6,6 +6,8 @@
 #include "util.h"
 
 #include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define FSM_START -1
 #define FSM_BLANK_FOR_KEY 0
@@ -25,24 +27,81 @@ static int comm_is_blank(char c);
  */
 static int comm_is_in_token_cs(char c);
 
+/**
+ * A character belongs to a quoted value if it is none of '"', '\\', '\r', '\n'
+ */
+static int comm_is_in_ascii_cs(char c);
+
+/** FNV-1a over a C-string, truncated to 32 bits */
+static unsigned long comm_hash(const char* str);
+
+/** Index all the keys of a well formatted arena */
+static void comm_index_build(comm_arena_p A);
+
+/** Linear scan of the arena; used when the index is not available */
+static int comm_get_linear(comm_arena_p A, const char* key, comm_p COMM);
+
+/* Source of a binary command: a read-ahead buffer or a span of memory */
+typedef struct comm_bin_src_t
+{
+    rbuffer_p   B;   /* NULL if reading from memory */
+    const char* mem; /* Next byte to read, if B is NULL */
+    size_t      sz;  /* Bytes left in mem */
+}* comm_bin_src_p;
+
+/**
+ * Tell whether no more bytes can be read from S.
+ *
+ * Return:
+ * - 1, on EOF;
+ * - 0, if at least one byte can be read;
+ * - -1, on read error (errno is set).
+ */
+static int comm_bin_eof(comm_bin_src_p S);
+
+/**
+ * Read exactly `n` bytes from S into `dst`.
+ *
+ * Return:
+ * - OK;
+ * - ILLEGAL_FORMAT, if EOF is reached before `n` bytes are read;
+ * - ERRNO_SPLIT + errno, on read error.
+ */
+static int comm_bin_read(comm_bin_src_p S, char* dst, size_t n);
+
+/** Read a 4 bytes, unsigned, big endian integer */
+static int comm_bin_read_u32(comm_bin_src_p S, unsigned long* u);
+
+/**
+ * Read a length-prefixed string into the arena as an SS Block starting at byte
+ * `*off`; `*off` is moved past the block.
+ */
+static int
+comm_bin_read_ss(comm_bin_src_p S, comm_arena_p A, int* off, int is_key);
+
+/** Decode one binary command from S into A; shared by all binary sources */
+static int comm_bin_decode(comm_bin_src_p S, comm_arena_p A);
+
+/** Make sure the arena can hold at least `bytes` bytes */
+static int comm_arena_reserve(comm_arena_p A, long bytes);
+
+/** If the last text command is ended by <CR>, consume the <LF> following it */
+static int comm_skip_lf(rbuffer_p B, comm_arena_p A);
+
 struct char_block_t
 {
     char* buf;
     int   sz;
-    int cur; /* Next index to write to. Always set to a valid index. If `buf` is
-                full, `cur` is kept set to `sz - 1`. The user shall not check if
-                `buf` is full by comparing `cur` to `sz`, but rather in its own
-                way. */
+    int cur; /* Next index to write to. Always set to a valid index: when it
+                would reach `sz`, the arena is grown first. */
 };
 
 struct int_block_t
 {
     int* buf;
     int  sz;
-    int cur; /* Next index to write to. Always set to a valid index. If `buf` is
-                full, `cur` is kept set to `sz - 1`. The user shall not check if
-                `buf` is full by comparing `cur` to `sz`, but rather in its own
-                way. */
+    int cur; /* Next index to write to. Always set to a valid index: when it
+                would reach `sz`, the arena is grown first. */
 };
 
 typedef struct arena_builder_t
@@ -51,7 +110,7 @@ typedef struct arena_builder_t
     struct int_block_t  i;
     struct char_block_t c;
 
-    file_p F;
+    rbuffer_p B;
 
     int* str_init; /* Pointer to the integer before the string first char */
     int  rounder; /* If equal to sizeof int tells that next char index increment
@@ -71,7 +130,13 @@ void arena_builder_dump(arena_builder_p);
 #endif
 
 /** Initialize an arena builder with default values */
-void arena_builder_init(arena_builder_p ARENA, file_p F, int* rawarena, int sz);
+void arena_builder_init(arena_builder_p ARENA, rbuffer_p B, comm_arena_p A);
+
+/**
+ * Double the arena capacity, preserving its content, and rebase the builder on
+ * the new buffer. The caller hands the buffer back to the comm_arena_t.
+ */
+void arena_builder_grow(arena_builder_p ARENA);
 
 /** Increase char cur by one and int cur accordingly */
 void arena_builder_incr(arena_builder_p ARENA);
@@ -82,9 +147,21 @@ void arena_builder_incr_int(arena_builder_p ARENA);
 /** Read next char */
 void arena_builder_read_next(arena_builder_p ARENA);
 
+/**
+ * If the machine is reading a key or a value, append to the current string all
+ * the buffered characters up to the next delimiter (or to the end of the
+ * buffered block). Delimiters are left in the buffer for the FSM to handle.
+ */
+void arena_builder_read_run(arena_builder_p ARENA);
+
 /** Append last read char */
 void arena_builder_append(arena_builder_p ARENA);
 
+/** Append `len` chars from `run` */
+void arena_builder_append_run(
+    arena_builder_p ARENA, const char* run, ssize_t len
+);
+
 /** Close the string and advance */
 void arena_builder_close(arena_builder_p ARENA);
 
@@ -158,9 +235,14 @@ void arena_builder_read_next(arena_builder_p ARENA)
 {
     ssize_t rb;
 
-    rb = file_read(ARENA->F, &ARENA->ch, sizeof(char));
+    rb = rbuffer_fill(ARENA->B);
 
-    if (rb == 0) /* EOF */
+    if (rb > 0)
+    {
+        ARENA->ch = ARENA->B->buffer[ARENA->B->cur];
+        ++ARENA->B->cur;
+    }
+    else if (rb == 0) /* EOF */
     {
         ARENA->done = 1;
 
@@ -211,19 +293,55 @@ void arena_builder_read_next(arena_builder_p ARENA)
     }
 }
 
-void arena_builder_incr(arena_builder_p ARENA)
+void arena_builder_read_run(arena_builder_p ARENA)
 {
-    ARENA->c.cur += 1;
+    ssize_t     avail;
+    ssize_t     len;
+    const char* run;
 
-    if (ARENA->c.cur >= ARENA->c.sz)
+    /* EOF and errors are left to arena_builder_read_next */
+    avail = rbuffer_fill(ARENA->B);
+    if (avail <= 0)
+        return;
+
+    run = ARENA->B->buffer + ARENA->B->cur;
+
+    switch (ARENA->state)
     {
-        ARENA->res = BUFFER_FULL;
+    case FSM_READ_KEY:
+    case FSM_READ_VAL_VALUE:
+        for (len = 0; len < avail && comm_is_in_token_cs(run[len]); ++len)
+            ;
+        break;
 
-        /* Cancel update: `cur` must always be set to a writeable index */
-        ARENA->c.cur -= 1;
+    case FSM_READ_VAL_ASCII:
+        for (len = 0; len < avail && comm_is_in_ascii_cs(run[len]); ++len)
+            ;
+        break;
+
+    default:
         return;
     }
 
+    if (len == 0)
+        return;
+
+    arena_builder_append_run(ARENA, run, len);
+    return_void_iferr(ARENA->res);
+
+    ARENA->B->cur += len;
+}
+
+void arena_builder_incr(arena_builder_p ARENA)
+{
+    if (ARENA->c.cur + 1 >= ARENA->c.sz)
+    {
+        arena_builder_grow(ARENA);
+        return_void_iferr(ARENA->res);
+    }
+
+    ARENA->c.cur += 1;
+
     if (ARENA->rounder == sizeof_i(int))
     {
         ARENA->i.cur += 1;
@@ -235,41 +353,61 @@ void arena_builder_incr(arena_builder_p ARENA)
 
 void arena_builder_incr_int(arena_builder_p ARENA)
 {
+    if (ARENA->c.cur + sizeof_i(int) >= ARENA->c.sz)
+    {
+        arena_builder_grow(ARENA);
+        return_void_iferr(ARENA->res);
+    }
+
     ARENA->c.cur += sizeof_i(int);
     ARENA->i.cur += 1;
+}
+
+void arena_builder_grow(arena_builder_p ARENA)
+{
+    int* buf;
+    long str_init_off;
 
-    if (ARENA->c.cur >= ARENA->c.sz)
+    if (ARENA->i.sz > INT_MAX / sizeof_i(int) / 2)
     {
-        ARENA->res   = BUFFER_FULL;
-        ARENA->c.cur = ARENA->c.sz - 1;
-        ARENA->i.cur -= 1;
+        ARENA->res = ERRNO_SPLIT + EOVERFLOW;
         return;
     }
+
+    str_init_off = ARENA->str_init - ARENA->i.buf;
+
+    buf = realloc(ARENA->i.buf, (size_t)ARENA->i.sz * 2 * sizeof(int));
+    if (buf == NULL)
+    {
+        ARENA->res = ERRNO_SPLIT + ENOMEM;
+        return;
+    }
+
+    ARENA->i.buf    = buf;
+    ARENA->i.sz     = ARENA->i.sz * 2;
+    ARENA->c.buf    = (char*)buf;
+    ARENA->c.sz     = ARENA->i.sz * sizeof_i(int);
+    ARENA->str_init = buf + str_init_off;
 }
 
-void arena_builder_init(arena_builder_p ARENA, file_p F, int* rawarena, int n)
+void arena_builder_init(arena_builder_p ARENA, rbuffer_p B, comm_arena_p A)
 {
-    if (n <= 0)
+    if (A->n <= 0)
     {
         strncpy(error_message, "comm_next: arena size <= 0", MAX_ERROR_SIZE);
         ARENA->res = FATAL_LOGIC;
         return;
     }
 
-    ARENA->i.buf = rawarena;
-    ARENA->i.sz  = n;
+    ARENA->i.buf = A->buf;
+    ARENA->i.sz  = A->n;
     ARENA->i.cur = 0;
 
-    if (n > INT_MAX / sizeof_i(int))
-    {
-        ARENA->res = ERRNO_SPLIT + EOVERFLOW;
-        return;
-    }
-    ARENA->c.buf    = (char*)rawarena;
-    ARENA->c.sz     = n * sizeof_i(int);
-    ARENA->c.cur    = 0;
+    ARENA->c.buf = (char*)A->buf;
+    ARENA->c.sz  = A->n * sizeof_i(int);
+    ARENA->c.cur = 0;
 
-    ARENA->F        = F;
+    ARENA->B        = B;
     ARENA->rounder  = 1;
     ARENA->state    = FSM_START;
     ARENA->res      = OK;
@@ -288,6 +426,28 @@ void arena_builder_append(arena_builder_p ARENA)
     return_void_iferr(ARENA->res);
 }
 
+void arena_builder_append_run(
+    arena_builder_p ARENA, const char* run, ssize_t len
+)
+{
+    /* Same condition as appending `len` chars one by one: `cur` must always
+     * be set to a writeable index */
+    while (len >= (ssize_t)(ARENA->c.sz - ARENA->c.cur))
+    {
+        arena_builder_grow(ARENA);
+        return_void_iferr(ARENA->res);
+    }
+
+    memcpy(ARENA->c.buf + ARENA->c.cur, run, (size_t)len);
+
+    ARENA->c.cur += (int)len;
+    ARENA->strlen += (int)len;
+
+    /* Keep int cur and rounder in sync with char cur */
+    ARENA->i.cur   = ARENA->c.cur / sizeof_i(int);
+    ARENA->rounder = ARENA->c.cur % sizeof_i(int) + 1;
+}
+
 void arena_builder_close(arena_builder_p ARENA)
 {
     if (ARENA->strlen > 0)
@@ -521,12 +681,11 @@ void arena_builder_exec_esc(arena_builder_p ARENA)
 
 /**
  * Parameters:
- * - F: file to read;
- * - arena: memory buffer into which the input is formatted and stored;
- * - n: size of arena in terms of number of storable integers.
+ * - B: read-ahead buffer of the file to read;
+ * - A: arena into which the input is formatted, stored and indexed.
  *
  * Errors:
- * - BUFFER_FULL: if arena is not big enough;
+ * - ERRNO_SPLIT + ENOMEM/EOVERFLOW: if the arena cannot grow any further;
  * - FATAL_LOGIC: if a logical error happens;
  * - ILLEGAL_FORMAT: in an uinexpected token is encountered.
  *
@@ -552,21 +711,32 @@ void arena_builder_exec_esc(arena_builder_p ARENA)
  * ^^^^
  * Int representation of 0.
  */
-int comm_next(file_p F, int* rawarena, int n)
+int comm_next(rbuffer_p B, comm_arena_p A)
 {
     struct arena_builder_t ARENA;
+    char                   last = '\0'; /* Last char handled by the FSM */
+
+    A->eol = 0;
 
-    arena_builder_init(&ARENA, F, rawarena, n);
+    arena_builder_init(&ARENA, B, A);
     return_iferr(ARENA.res);
 
     for (; ARENA.res == OK && !ARENA.done;)
     {
+        /* Bulk-append keys and values; only delimiters go through the FSM */
+        arena_builder_read_run(&ARENA);
+        if (ARENA.res != OK)
+            break;
+
         arena_builder_read_next(&ARENA);
-        return_iferr(ARENA.res);
+        if (ARENA.res != OK)
+            break;
 
         if (ARENA.done)
             break;
 
+        last = ARENA.ch;
+
         switch (ARENA.state)
         {
         case FSM_START:
@@ -603,28 +773,396 @@ int comm_next(file_p F, int* rawarena, int n)
         }
     }
 
+    /* The arena may have been grown */
+    A->buf = ARENA.i.buf;
+    A->n   = ARENA.i.sz;
+
+    /* If the command is not ended by EOF, the FSM is done on a newline; an
+     * illegal newline also ends the command, see comm_skip_line */
+    if ((ARENA.done || ARENA.res == ILLEGAL_FORMAT) &&
+        (last == '\r' || last == '\n'))
+        A->eol = last;
+
     switch (ARENA.res)
     {
     case ILLEGAL_FORMAT:
         strncpy(error_message, "Illegal format", MAX_ERROR_SIZE);
         break;
-    case BUFFER_FULL:
+    case ERRNO_SPLIT + ENOMEM:
+    case ERRNO_SPLIT + EOVERFLOW:
         strncpy(
             error_message,
-            "Buffer full; Command arena too small",
+            "comm_next: could not grow command arena",
             MAX_ERROR_SIZE
         );
         break;
     }
 
+    if (ARENA.res == OK)
+        comm_index_build(A);
+
     return ARENA.res;
 }
 
+int comm_open(rbuffer_p B, int* mode)
+{
+    ssize_t               avail;
+    char                  magic[COMM_BIN_MAGIC_SIZE];
+    int                   res;
+    struct comm_bin_src_t S;
+
+    *mode = COMM_MODE_TEXT;
+
+    avail = rbuffer_fill(B);
+    if (avail < 0)
+    {
+        strncpy(error_message, "comm_open", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + errno;
+    }
+
+    if (avail == 0 || B->buffer[B->cur] != '\0')
+        return OK;
+
+    S.B   = B;
+    S.mem = NULL;
+    S.sz  = 0;
+
+    res   = comm_bin_read(&S, magic, sizeof(magic));
+    if (res == OK && memcmp(magic, COMM_BIN_MAGIC, sizeof(magic)) != 0)
+        res = ILLEGAL_FORMAT;
+
+    if (res == ILLEGAL_FORMAT)
+        strncpy(error_message, "Illegal binary header", MAX_ERROR_SIZE);
+    return_iferr(res);
+
+    *mode = COMM_MODE_BIN;
+
+    return OK;
+}
+
+int comm_next_bin(rbuffer_p B, comm_arena_p A)
+{
+    struct comm_bin_src_t S;
+
+    S.B   = B;
+    S.mem = NULL;
+    S.sz  = 0;
+
+    return comm_bin_decode(&S, A);
+}
+
+int comm_parse_bin(const char* cmd, size_t sz, comm_arena_p A)
+{
+    struct comm_bin_src_t S;
+    int                   res;
+
+    S.B   = NULL;
+    S.mem = cmd;
+    S.sz  = sz;
+
+    res   = comm_bin_decode(&S, A);
+    return_iferr(res);
+
+    if (S.sz > 0)
+    {
+        strncpy(
+            error_message,
+            "Illegal binary command: trailing bytes",
+            MAX_ERROR_SIZE
+        );
+        return ILLEGAL_FORMAT;
+    }
+
+    return OK;
+}
+
+static int comm_bin_decode(comm_bin_src_p S, comm_arena_p A)
+{
+    int           eof;
+    unsigned long count;
+    int           off = 0;
+    int           res;
+
+    A->eol = 0;
+
+    eof    = comm_bin_eof(S);
+    if (eof < 0)
+    {
+        strncpy(error_message, "comm_bin_decode", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + errno;
+    }
+
+    /* EOF: empty command, as the text protocol does */
+    if (!eof)
+    {
+        res = comm_bin_read_u32(S, &count);
+
+        for (; res == OK && count > 0; --count)
+        {
+            res = comm_bin_read_ss(S, A, &off, 1);
+            if (res == OK)
+                res = comm_bin_read_ss(S, A, &off, 0);
+        }
+
+        switch (res)
+        {
+        case ILLEGAL_FORMAT:
+            strncpy(error_message, "Illegal binary command", MAX_ERROR_SIZE);
+            break;
+        case ERRNO_SPLIT + ENOMEM:
+        case ERRNO_SPLIT + EOVERFLOW:
+            strncpy(
+                error_message,
+                "comm_bin_decode: could not grow command arena",
+                MAX_ERROR_SIZE
+            );
+            break;
+        }
+        return_iferr(res);
+    }
+
+    /* Terminator; room for it is reserved by comm_bin_read_ss */
+    res = comm_arena_reserve(A, (long)off + sizeof_i(int));
+    return_iferr(res);
+
+    *ptr_add_bytes(int, A->buf, off) = 0;
+
+    comm_index_build(A);
+
+    return OK;
+}
+
+static int comm_bin_eof(comm_bin_src_p S)
+{
+    ssize_t avail;
+
+    if (S->B == NULL)
+        return S->sz == 0;
+
+    avail = rbuffer_fill(S->B);
+    if (avail < 0)
+        return -1;
+
+    return avail == 0;
+}
+
+static int comm_bin_read(comm_bin_src_p S, char* dst, size_t n)
+{
+    ssize_t avail;
+    size_t  chunk;
+
+    if (S->B == NULL)
+    {
+        if (S->mem == NULL || n > S->sz)
+            return ILLEGAL_FORMAT;
+
+        if (dst != NULL)
+            memcpy(dst, S->mem, n);
+
+        S->mem += n;
+        S->sz -= n;
+
+        return OK;
+    }
+
+    while (n > 0)
+    {
+        avail = rbuffer_fill(S->B);
+
+        if (avail == 0)
+            return ILLEGAL_FORMAT;
+
+        if (avail < 0)
+        {
+            strncpy(error_message, "comm_bin_read", MAX_ERROR_SIZE);
+            return ERRNO_SPLIT + errno;
+        }
+
+        chunk = (size_t)avail < n ? (size_t)avail : n;
+        if (dst != NULL)
+        {
+            memcpy(dst, S->B->buffer + S->B->cur, chunk);
+            dst += chunk;
+        }
+
+        S->B->cur += (ssize_t)chunk;
+        n -= chunk;
+    }
+
+    return OK;
+}
+
+static int comm_bin_read_u32(comm_bin_src_p S, unsigned long* u)
+{
+    unsigned char buf[4];
+    int           res;
+
+    res = comm_bin_read(S, (char*)buf, sizeof(buf));
+    return_iferr(res);
+
+    *u = ((unsigned long)buf[0] << 24) | ((unsigned long)buf[1] << 16) |
+         ((unsigned long)buf[2] << 8) | (unsigned long)buf[3];
+
+    return OK;
+}
+
+static int
+comm_bin_read_ss(comm_bin_src_p S, comm_arena_p A, int* off, int is_key)
+{
+    unsigned long len;
+    long          sz; /* SS Block string size, including NUL-terminators */
+    char*         str;
+    int           res;
+
+    res = comm_bin_read_u32(S, &len);
+    return_iferr(res);
+
+    if (is_key && len == 0)
+        return ILLEGAL_FORMAT;
+
+    /* At least one NUL-terminator, then round up to int alignment */
+    sz = len == 0 ? 0
+                  : ((long)len + sizeof_i(int)) / sizeof_i(int) * sizeof_i(int);
+
+    /* Room for the size, the string and the next size (or terminator) */
+    if (sz > INT_MAX - *off - 2 * sizeof_i(int))
+        return ERRNO_SPLIT + EOVERFLOW;
+
+    res = comm_arena_reserve(A, (long)*off + 2 * sizeof_i(int) + sz);
+    return_iferr(res);
+
+    *ptr_add_bytes(int, A->buf, *off) = (int)sz;
+    str = ptr_add_bytes(char, A->buf, *off + sizeof_i(int));
+
+    res = comm_bin_read(S, str, len);
+    return_iferr(res);
+
+    if (memchr(str, '\0', len) != NULL)
+        return ILLEGAL_FORMAT;
+
+    memset(str + len, 0, (size_t)sz - len);
+
+    *off += sizeof_i(int) + (int)sz;
+
+    return OK;
+}
+
+static int comm_arena_reserve(comm_arena_p A, long bytes)
+{
+    int* buf;
+    int  n = A->n;
+
+    while ((long)n * sizeof_i(int) < bytes)
+    {
+        if (n > INT_MAX / sizeof_i(int) / 2)
+            return ERRNO_SPLIT + EOVERFLOW;
+        n *= 2;
+    }
+
+    if (n == A->n)
+        return OK;
+
+    buf = realloc(A->buf, (size_t)n * sizeof(int));
+    if (buf == NULL)
+        return ERRNO_SPLIT + ENOMEM;
+
+    A->buf = buf;
+    A->n   = n;
+
+    return OK;
+}
+
+int comm_read_block(rbuffer_p B, comm_arena_p A, char* dst, size_t sz)
+{
+    struct comm_bin_src_t S;
+    int                   res;
+
+    if (sz == 0)
+        return OK;
+
+    /* A text command ended by <CR><LF>: the block starts after <LF> */
+    res = comm_skip_lf(B, A);
+    return_iferr(res);
+
+    S.B   = B;
+    S.mem = NULL;
+    S.sz  = 0;
+
+    res   = comm_bin_read(&S, dst, sz);
+    if (res == ILLEGAL_FORMAT)
+        strncpy(error_message, "Inline block truncated", MAX_ERROR_SIZE);
+
+    return res;
+}
+
+int comm_is_empty(comm_arena_p A)
+{
+    return A->buf[0] == 0;
+}
+
+int comm_skip_line(rbuffer_p B, comm_arena_p A)
+{
+    ssize_t avail;
+    char*   p;
+
+    for (; A->eol == 0;)
+    {
+        avail = rbuffer_fill(B);
+        if (avail == 0)
+            return OK;
+
+        if (avail < 0)
+        {
+            strncpy(error_message, "comm_skip_line", MAX_ERROR_SIZE);
+            return ERRNO_SPLIT + errno;
+        }
+
+        for (p = B->buffer + B->cur; p < B->buffer + B->count; ++p)
+            if (*p == '\r' || *p == '\n')
+            {
+                A->eol = *p++;
+                break;
+            }
+
+        B->cur = p - B->buffer;
+    }
+
+    return comm_skip_lf(B, A);
+}
+
+static int comm_skip_lf(rbuffer_p B, comm_arena_p A)
+{
+    ssize_t avail;
+
+    if (A->eol != '\r')
+        return OK;
+
+    avail = rbuffer_fill(B);
+    if (avail < 0)
+    {
+        strncpy(error_message, "comm_skip_lf", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + errno;
+    }
+
+    if (avail > 0 && B->buffer[B->cur] == '\n')
+        ++B->cur;
+
+    /* The <LF> is consumed once */
+    A->eol = '\n';
+
+    return OK;
+}
+
 static int comm_is_blank(char c)
 {
     return c == ' ' || c == '\n' || c == '\r' || c == '\t';
 }
 
+static int comm_is_in_ascii_cs(char c)
+{
+    return c != '"' && c != '\\' && c != '\r' && c != '\n';
+}
+
 static int comm_is_in_token_cs(char c)
 {
     if (c >= 'a' && c <= 'z')
@@ -639,12 +1177,132 @@ static int comm_is_in_token_cs(char c)
     return c == '-';
 }
 
-int comm_get(const int* arena, const char* key, comm_p COMM)
+int comm_arena_init(comm_arena_p A)
+{
+    A->buf = malloc(COMM_ARENA_INIT_SIZE * sizeof(int));
+    if (A->buf == NULL)
+        return ERRNO_SPLIT + ENOMEM;
+
+    A->n       = COMM_ARENA_INIT_SIZE;
+    A->indexed = 0;
+
+    /* Empty arena: just the terminator */
+    A->buf[0]  = 0;
+
+    return OK;
+}
+
+void comm_arena_free(comm_arena_p A)
+{
+    free(A->buf);
+    A->buf = NULL;
+    A->n   = 0;
+}
+
+static unsigned long comm_hash(const char* str)
+{
+    unsigned long h = 2166136261UL;
+
+    for (; *str; ++str)
+    {
+        h ^= (unsigned char)*str;
+        h = (h * 16777619UL) & 0xFFFFFFFFUL;
+    }
+
+    return h;
+}
+
+static void comm_index_build(comm_arena_p A)
+{
+    int*          cur_size;
+    char*         cur_str;
+    char*         key;
+    unsigned long h;
+    unsigned long i;
+    int           count = 0;
+
+    for (i = 0; i < COMM_INDEX_SIZE; ++i)
+        A->index[i].key = -1;
+
+    A->indexed = 1;
+
+    cur_size   = A->buf;
+    cur_str    = (char*)cur_size + sizeof_i(int);
+
+    while (*cur_size > 0)
+    {
+        /* Keep load factor under 3/4 */
+        if (++count > COMM_INDEX_SIZE / 4 * 3)
+        {
+            A->indexed = 0;
+            return;
+        }
+
+        key = cur_str;
+        h   = comm_hash(key);
+
+        /* Value */
+        cur_size = ptr_add_bytes(int, cur_str, *cur_size);
+        cur_str  = ptr_add_bytes(char, cur_size, sizeof(int));
+
+        for (i = h & (COMM_INDEX_SIZE - 1); A->index[i].key >= 0;
+             i = (i + 1) & (COMM_INDEX_SIZE - 1))
+            if (A->index[i].hash == h &&
+                strcmp((char*)A->buf + A->index[i].key, key) == 0)
+                break;
+
+        /* First occurrence wins, as it does for a linear scan */
+        if (A->index[i].key < 0)
+        {
+            A->index[i].hash  = h;
+            A->index[i].key   = (int)(key - (char*)A->buf);
+            A->index[i].value = *cur_size > 0
+                                    ? (int)(cur_str - (char*)A->buf)
+                                    : -1;
+        }
+
+        /* Key */
+        cur_size = ptr_add_bytes(int, cur_str, *cur_size);
+        cur_str  = ptr_add_bytes(char, cur_size, sizeof(int));
+    }
+}
+
+int comm_get(comm_arena_p A, const char* key, comm_p COMM)
+{
+    unsigned long h;
+    unsigned long i;
+
+    if (!A->indexed)
+        return comm_get_linear(A, key, COMM);
+
+    h = comm_hash(key);
+
+    for (i = h & (COMM_INDEX_SIZE - 1); A->index[i].key >= 0;
+         i = (i + 1) & (COMM_INDEX_SIZE - 1))
+    {
+        if (A->index[i].hash != h ||
+            strcmp((char*)A->buf + A->index[i].key, key) != 0)
+            continue;
+
+        COMM->key = (char*)A->buf + A->index[i].key;
+
+        if (A->index[i].value >= 0)
+            COMM->value = (char*)A->buf + A->index[i].value;
+        else
+            COMM->value = NULL;
+
+        return OK;
+    }
+
+    return NOT_FOUND;
+}
+
+static int comm_get_linear(comm_arena_p A, const char* key, comm_p COMM)
 {
     const int* cur_size;
     char*      cur_str;
 
-    cur_size = arena;
+    cur_size = A->buf;
     cur_str  = (char*)cur_size + sizeof_i(int);
 
     while (*cur_size > 0 && strcmp(cur_str, key) != 0)
@@ -675,12 +1333,12 @@ int comm_get(const int* arena, const char* key, comm_p COMM)
 }
 
 /* To be called manually, during debug sessions */
-void comm_dump(int* arena)
+void comm_dump(comm_arena_p A)
 {
     int*  cur_size;
     char* cur_str;
 
-    cur_size = arena;
+    cur_size = A->buf;
     cur_str  = (char*)cur_size + sizeof_i(int);
 
     while (*cur_size > 0)
@@ -5,6 +5,21 @@
 #define CMC_EML_COMM_H_INCLUDED
 
 #include "io.h"
+#include "util.h"
+
+/* Must be a power of 2 */
+#define COMM_INDEX_SIZE 128
+
+/* Initial arena capacity, in integers; the arena doubles whenever it is full */
+#define COMM_ARENA_INIT_SIZE 1024
+
+/* Command stream protocols; see comm_open */
+#define COMM_MODE_TEXT 0
+#define COMM_MODE_BIN 1
+
+/* Binary stream header: a leading NUL is never valid in the text protocol */
+#define COMM_BIN_MAGIC "\0cmc-eml\1"
+#define COMM_BIN_MAGIC_SIZE 9
 
 typedef struct comm_t
 {
@@ -12,19 +27,121 @@ typedef struct comm_t
     char* value;
 }* comm_p;
 
+/* Open-addressing slot; offsets are in bytes from the start of the arena */
+struct comm_index_slot_t
+{
+    unsigned long hash;
+    int           key;   /* -1 if the slot is empty */
+    int           value; /* -1 if the value is empty (NULL) */
+};
+
+typedef struct comm_arena_t
+{
+    int* buf; /* KV Blocks, see comm_next; heap allocated */
+    int  n;   /* Number of integers that can be stored in buf */
+
+    struct comm_index_slot_t index[COMM_INDEX_SIZE];
+    int indexed; /* If 0, too many keys: comm_get falls back to a linear scan */
+
+    int eol; /* '\r' or '\n' if it ended the last text command, 0 otherwise */
+}* comm_arena_p;
+
+/**
+ * Allocate an empty arena of COMM_ARENA_INIT_SIZE integers.
+ *
+ * The arena is meant to be reused across commands: it grows geometrically while
+ * parsing and never shrinks, until comm_arena_free is called.
+ *
+ * Return:
+ * - OK;
+ * - ERRNO_SPLIT + ENOMEM, if the arena could not be allocated.
+ */
+extern int comm_arena_init(comm_arena_p A);
+
+/** Release the memory held by an arena */
+extern void comm_arena_free(comm_arena_p A);
+
 /**
  * Parameters:
- * - file_p F: file to read;
- * - int* arena: memory allocated to store key-value pairs;
- * - int n: number of integers that can be stored in the arena.
+ * - rbuffer_p B: read-ahead buffer over the file to read; bytes following the
+ *   parsed command are kept in B for the next call;
+ * - comm_arena_p A: arena into which key-value pairs are stored and indexed;
+ *   A->buf may be reallocated, thus pointers into a previous command are not
+ *   valid anymore.
+ */
+extern int comm_next(rbuffer_p B, comm_arena_p A);
+
+/**
+ * Detect the protocol of a command stream, before the first command is read.
+ *
+ * A stream whose first byte is NUL must start with COMM_BIN_MAGIC, which is
+ * consumed, and uses the binary protocol (see comm_next_bin); any other stream
+ * uses the text protocol (see comm_next).
+ *
+ * Return:
+ * - OK, with *mode set to COMM_MODE_TEXT or COMM_MODE_BIN;
+ * - ILLEGAL_FORMAT, if the binary header is not valid;
+ * - ERRNO_SPLIT + errno, on read error.
+ */
+extern int comm_open(rbuffer_p B, int* mode);
+
+/**
+ * Binary counterpart of comm_next: it fills the same arena layout, thus
+ * commands are handled the same way regardless of the protocol.
+ *
+ * A command is made up by:
+ * - count: 4 bytes, unsigned, big endian: number of key-value pairs;
+ * - count times:
+ *   - key length: 4 bytes, unsigned, big endian; must be > 0;
+ *   - key bytes, not NUL-terminated;
+ *   - value length: 4 bytes, unsigned, big endian; 0 means no value;
+ *   - value bytes, not NUL-terminated.
+ *
+ * Keys and values must not contain NUL bytes.
+ */
+extern int comm_next_bin(rbuffer_p B, comm_arena_p A);
+
+/**
+ * Same as comm_next_bin, but the command is read from the `sz` bytes at `cmd`,
+ * which must hold exactly one command. An empty span is an empty command.
+ */
+extern int comm_parse_bin(const char* cmd, size_t sz, comm_arena_p A);
+
+/**
+ * Read the `sz` bytes raw block that follows the last command read from B,
+ * either by comm_next or comm_next_bin. If `dst` is NULL, the block is read and
+ * discarded.
+ *
+ * In the text protocol the block starts right after the newline ending the
+ * command; if the command is ended by <CR><LF>, it starts after <LF>. In the
+ * binary protocol it starts right after the command. Empty blocks take no
+ * bytes at all.
+ *
+ * Return:
+ * - OK;
+ * - ILLEGAL_FORMAT, if EOF is reached before `sz` bytes are read;
+ * - ERRNO_SPLIT + errno, on read error.
+ */
+extern int comm_read_block(rbuffer_p B, comm_arena_p A, char* dst, size_t sz);
+
+/** Tell whether the last command read into A has no key-value pairs */
+extern int comm_is_empty(comm_arena_p A);
+
+/**
+ * Discard what is left of the text line a failed comm_next stopped in, so
+ * that the next comm_next starts from the following command.
+ *
+ * Return:
+ * - OK, also if EOF is reached;
+ * - ERRNO_SPLIT + errno, on read error.
  */
-extern int comm_next(file_p F, int* arena, int n);
+extern int comm_skip_line(rbuffer_p B, comm_arena_p A);
 
 /**
- * Search for a key-value in the arena.
+ * Search for a key-value in the arena, through the index built by comm_next.
  *
  * If key-value is found, COMM is set with key and value. COMM members MUST NOT
- * be freed.
+ * be freed. If a key is repeated, the first occurrence is returned.
  *
  * Return:
  * - OK, if the key-value is found
@@ -34,11 +151,11 @@ extern int comm_next(file_p F, int* arena, int n);
  * This function assumes that the arena is well formatted, thus it does not
  * check alignement.
  */
-extern int comm_get(const int* arena, const char* key, comm_p COMM);
+extern int comm_get(comm_arena_p A, const char* key, comm_p COMM);
 
 /**
  * Dump an arena on stderr
  */
-extern void comm_dump(int* arena);
+extern void comm_dump(comm_arena_p A);
 
 #endif /* CMC_EML_COMM_H_INCLUDED */
@@ -0,0 +1,144 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#include "feat.h"
+
+#include "cqueue.h"
+#include "error.h"
+
+#include <stdlib.h>
+
+int cqueue_init(cqueue_p Q, unsigned int size)
+{
+    unsigned int i;
+    int          res;
+
+    Q->slots = NULL;
+    Q->size  = 0;
+    Q->first = 0;
+    Q->count = 0;
+
+    if (size == 0 || size > CQUEUE_MAX_SIZE)
+    {
+        strncpy(error_message, "cqueue_init: invalid size", MAX_ERROR_SIZE);
+        return FATAL_PARAM;
+    }
+
+    Q->slots = malloc(size * sizeof(struct cqueue_slot_t));
+    if (Q->slots == NULL)
+    {
+        strncpy(error_message, "cqueue_init: malloc", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + errno;
+    }
+
+    for (; Q->size < size; ++Q->size)
+    {
+        res = comm_arena_init(&Q->slots[Q->size].A);
+        if (res != OK)
+        {
+            for (i = 0; i < Q->size; ++i)
+                comm_arena_free(&Q->slots[i].A);
+
+            free(Q->slots);
+            Q->slots = NULL;
+            Q->size  = 0;
+
+            strncpy(error_message, "cqueue_init: arena", MAX_ERROR_SIZE);
+            return res;
+        }
+
+        Q->slots[Q->size].block = NULL;
+    }
+
+    res = pthread_mutex_init(&Q->lock, NULL);
+    assert(res == 0, ERRNO_SPLIT + res, "cqueue_init: mutex");
+
+    res = pthread_cond_init(&Q->filled, NULL);
+    assert(res == 0, ERRNO_SPLIT + res, "cqueue_init: cond");
+
+    res = pthread_cond_init(&Q->freed, NULL);
+    assert(res == 0, ERRNO_SPLIT + res, "cqueue_init: cond");
+
+    return OK;
+}
+
+void cqueue_free(cqueue_p Q)
+{
+    unsigned int i;
+
+    if (Q->slots == NULL)
+        return;
+
+    for (i = 0; i < Q->size; ++i)
+    {
+        comm_arena_free(&Q->slots[i].A);
+        free(Q->slots[i].block);
+    }
+
+    free(Q->slots);
+    Q->slots = NULL;
+
+    pthread_cond_destroy(&Q->freed);
+    pthread_cond_destroy(&Q->filled);
+    pthread_mutex_destroy(&Q->lock);
+}
+
+cqueue_slot_p cqueue_reserve(cqueue_p Q)
+{
+    cqueue_slot_p slot;
+
+    pthread_mutex_lock(&Q->lock);
+
+    while (Q->count == Q->size)
+        pthread_cond_wait(&Q->freed, &Q->lock);
+
+    slot = Q->slots + (Q->first + Q->count) % Q->size;
+
+    pthread_mutex_unlock(&Q->lock);
+
+    return slot;
+}
+
+void cqueue_push(cqueue_p Q)
+{
+    pthread_mutex_lock(&Q->lock);
+
+    ++Q->count;
+    pthread_cond_signal(&Q->filled);
+
+    pthread_mutex_unlock(&Q->lock);
+}
+
+cqueue_slot_p cqueue_front(cqueue_p Q)
+{
+    cqueue_slot_p slot;
+
+    pthread_mutex_lock(&Q->lock);
+
+    while (Q->count == 0)
+        pthread_cond_wait(&Q->filled, &Q->lock);
+
+    slot = Q->slots + Q->first;
+
+    pthread_mutex_unlock(&Q->lock);
+
+    return slot;
+}
+
+void cqueue_pop(cqueue_p Q)
+{
+    cqueue_slot_p slot;
+
+    pthread_mutex_lock(&Q->lock);
+
+    /* The slot is not visible to the producer until it is popped */
+    slot = Q->slots + Q->first;
+    free(slot->block);
+    slot->block = NULL;
+
+    Q->first = (Q->first + 1) % Q->size;
+    --Q->count;
+    pthread_cond_signal(&Q->freed);
+
+    pthread_mutex_unlock(&Q->lock);
+}
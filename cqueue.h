@@ -0,0 +1,78 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#ifndef CMC_EML_CQUEUE_H_INCLUDED
+#define CMC_EML_CQUEUE_H_INCLUDED
+
+#include "feat.h"
+
+#include "comm.h"
+#include "error.h"
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * Bounded FIFO of parsed commands, between one producer thread, that parses
+ * commands ahead, and one consumer thread, that executes them in order.
+ *
+ * Slots are allocated once and reused: each slot owns an arena, thus commands
+ * are parsed and executed in place, with no copy. The producer fills the slot
+ * returned by cqueue_reserve, then publishes it by cqueue_push; the consumer
+ * handles the slot returned by cqueue_front, then gives it back by cqueue_pop.
+ */
+
+#define CQUEUE_MAX_SIZE 1024
+
+typedef struct cqueue_slot_t
+{
+    struct comm_arena_t A;
+
+    int res;     /* Outcome of the parser: OK or an error code */
+    int in_sync; /* If res != OK, the following commands can still be read */
+    int last;    /* No command follows this one */
+
+    char*  block;      /* Inline block that follows the command, or NULL */
+    size_t block_size; /* Also 0 if the command has no inline block */
+    int    block_res;  /* Outcome of reading the inline block */
+
+    char message[MAX_ERROR_SIZE]; /* error_message of the parser, if failed */
+}* cqueue_slot_p;
+
+typedef struct cqueue_t
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  filled; /* Signalled by cqueue_push */
+    pthread_cond_t  freed;  /* Signalled by cqueue_pop */
+
+    cqueue_slot_p slots;
+    unsigned int  size;
+    unsigned int  first; /* Index of the oldest slot pushed */
+    unsigned int  count; /* Slots pushed and not popped yet */
+}* cqueue_p;
+
+/**
+ * Allocate a queue of `size` slots, in range [1; CQUEUE_MAX_SIZE].
+ *
+ * Return:
+ * - OK;
+ * - FATAL_PARAM, if size is out of range;
+ * - ERRNO_SPLIT + errno, if the queue could not be allocated.
+ */
+extern int cqueue_init(cqueue_p Q, unsigned int size);
+
+extern void cqueue_free(cqueue_p Q);
+
+/** Wait for a free slot, to be filled by the producer */
+extern cqueue_slot_p cqueue_reserve(cqueue_p Q);
+
+/** Publish the slot returned by the last cqueue_reserve */
+extern void cqueue_push(cqueue_p Q);
+
+/** Wait for the oldest slot published and not popped yet */
+extern cqueue_slot_p cqueue_front(cqueue_p Q);
+
+/** Give the slot returned by cqueue_front back, releasing its inline block */
+extern void cqueue_pop(cqueue_p Q);
+
+#endif /* CMC_EML_CQUEUE_H_INCLUDED */
@@ -0,0 +1,307 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#include "feat.h"
+
+#include "crlf.h"
+#include "error.h"
+#include "util.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRLF_X86
+#include <immintrin.h>
+#endif
+
+/* Input bytes read per step by crlf_file_to_file */
+#define CRLF_CHUNK 49152
+
+typedef struct crlf_out_t
+{
+    struct wbuffer_t W;
+    int              last_cr; /* The last byte copied is <CR> */
+}* crlf_out_p;
+
+/**
+ * Return the position of the first bare <LF> in `src`, or `n` if there is
+ * none; `after_cr` tells whether the byte before `src` is <CR>.
+ */
+static size_t
+crlf_scan_scalar(const unsigned char* src, size_t n, int after_cr);
+
+#ifdef CRLF_X86
+static size_t crlf_scan_sse2(const unsigned char* src, size_t n, int after_cr);
+static size_t crlf_scan_avx2(const unsigned char* src, size_t n, int after_cr);
+#endif
+
+/** Set by crlf_init to the fastest scanner the CPU supports */
+static size_t (*crlf_scan)(const unsigned char* src, size_t n, int after_cr) =
+    crlf_scan_scalar;
+
+static void crlf_out_init(crlf_out_p O, file_p out);
+
+/** Return OK, or ERRNO_SPLIT + errno on write error */
+static int crlf_out_body(crlf_out_p O, const unsigned char* src, size_t n);
+
+/**
+ * Length of the canonical prefix of the regular file `in`, up to its first
+ * bare <LF>, read by pread into `buf` of CRLF_CHUNK bytes; -1 on read error.
+ */
+static off_t crlf_prefix(file_p in, unsigned char* buf);
+
+/**
+ * Write `n` bytes through the output buffer, in pieces if needed.
+ *
+ * Return OK, or ERRNO_SPLIT + errno on write error.
+ */
+static int crlf_out_put(crlf_out_p O, const unsigned char* src, size_t n);
+
+void crlf_init(void)
+{
+#ifdef CRLF_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        crlf_scan = crlf_scan_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        crlf_scan = crlf_scan_sse2;
+#endif
+}
+
+static size_t crlf_scan_scalar(const unsigned char* src, size_t n, int after_cr)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+    {
+        if (src[i] == '\n' && !after_cr)
+            return i;
+
+        after_cr = src[i] == '\r';
+    }
+
+    return n;
+}
+
+#ifdef CRLF_X86
+/* A bare <LF> is an <LF> whose previous byte is not <CR>: the mask of <CR>s is
+ * shifted by one, carrying the last bit over to the next block */
+
+__attribute__((target("sse2"))) static size_t
+crlf_scan_sse2(const unsigned char* src, size_t n, int after_cr)
+{
+    __m128i      v;
+    unsigned int lf;
+    unsigned int cr;
+    unsigned int bare;
+    size_t       i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        v  = _mm_loadu_si128((const __m128i*)(const void*)(src + i));
+        lf = (unsigned int)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))
+        );
+        cr = (unsigned int)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))
+        );
+
+        bare = lf & ~(cr << 1 | (unsigned int)after_cr);
+        if (bare != 0)
+            return i + (size_t)__builtin_ctz(bare);
+
+        after_cr = (int)(cr >> 15);
+    }
+
+    return i + crlf_scan_scalar(src + i, n - i, after_cr);
+}
+
+__attribute__((target("avx2"))) static size_t
+crlf_scan_avx2(const unsigned char* src, size_t n, int after_cr)
+{
+    __m256i      v;
+    unsigned int lf;
+    unsigned int cr;
+    unsigned int bare;
+    size_t       i;
+
+    for (i = 0; i + 32 <= n; i += 32)
+    {
+        v  = _mm256_loadu_si256((const __m256i*)(const void*)(src + i));
+        lf = (unsigned int)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))
+        );
+        cr = (unsigned int)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))
+        );
+
+        bare = lf & ~(cr << 1 | (unsigned int)after_cr);
+        if (bare != 0)
+            return i + (size_t)__builtin_ctz(bare);
+
+        after_cr = (int)(cr >> 31);
+    }
+
+    return i + crlf_scan_sse2(src + i, n - i, after_cr);
+}
+#endif
+
+static void crlf_out_init(crlf_out_p O, file_p out)
+{
+    wbuffer_init(&O->W, out);
+    O->last_cr = 0;
+}
+
+static int crlf_out_body(crlf_out_p O, const unsigned char* src, size_t n)
+{
+    size_t i = 0;
+    size_t run;
+    int    res;
+
+    if (n == 0)
+        return OK;
+
+    run = crlf_scan(src, n, O->last_cr);
+
+    /* Already canonical: no need to go through the buffer */
+    if (run == n)
+    {
+        res = wbuffer_flush(&O->W);
+        return_iferr(res);
+
+        res        = file_write(O->W.F, (const char*)src, n);
+        O->last_cr = src[n - 1] == '\r';
+
+        return res;
+    }
+
+    for (;;)
+    {
+        res = crlf_out_put(O, src + i, run);
+        return_iferr(res);
+        i += run;
+
+        if (i == n)
+            break;
+
+        /* src[i] is a bare <LF>: it is copied along with the next run */
+        res = crlf_out_put(O, (const unsigned char*)"\r", 1);
+        return_iferr(res);
+        run = 1 + crlf_scan(src + i + 1, n - i - 1, 0);
+    }
+
+    O->last_cr = src[n - 1] == '\r';
+
+    return OK;
+}
+
+size_t crlf_bare_lf(const char* buf, size_t n, int after_cr)
+{
+    return crlf_scan((const unsigned char*)buf, n, after_cr);
+}
+
+static off_t crlf_prefix(file_p in, unsigned char* buf)
+{
+    off_t   off      = 0;
+    int     after_cr = 0;
+    ssize_t rb;
+    size_t  run;
+
+    while ((rb = file_pread(in, (char*)buf, CRLF_CHUNK, off)) > 0)
+    {
+        run = crlf_scan(buf, (size_t)rb, after_cr);
+        off += (off_t)run;
+
+        if (run < (size_t)rb)
+            break;
+
+        after_cr = buf[rb - 1] == '\r';
+    }
+
+    return rb < 0 ? -1 : off;
+}
+
+static int crlf_out_put(crlf_out_p O, const unsigned char* src, size_t n)
+{
+    size_t fit;
+    char*  dst;
+    int    res;
+
+    while (n > 0)
+    {
+        fit = n < sizeof(O->W.buffer) ? n : sizeof(O->W.buffer);
+        res = wbuffer_room(&O->W, fit, &dst);
+        return_iferr(res);
+
+        memcpy(dst, src, fit);
+        O->W.cur += fit;
+
+        src += fit;
+        n -= fit;
+    }
+
+    return OK;
+}
+
+int crlf_file_to_file(file_p in, file_p out, off_t prefix)
+{
+    unsigned char src[CRLF_CHUNK];
+    ssize_t       rb  = 0;
+    int           res = OK;
+
+    struct crlf_out_t file_out;
+
+    crlf_out_init(&file_out, out);
+
+    if (file_isreg(in))
+    {
+        res = file_seek(in, 0, SEEK_SET);
+        if (res != OK)
+        {
+            strncpy(
+                error_message, "crlf_file_to_file: seek set", MAX_ERROR_SIZE
+            );
+            return res;
+        }
+
+        /* What needs no change is copied by the kernel, if it can; the rest
+         * follows a bare <LF>, thus no <CR> is pending */
+        if (out->mode != FILE_MODE_COUNT)
+        {
+            if (prefix < 0)
+                prefix = crlf_prefix(in, src);
+            if (prefix > 0)
+                res = file_copy_n(out, in, prefix);
+        }
+    }
+
+    while (res == OK && (rb = file_read(in, (char*)src, sizeof(src))) > 0)
+        res = crlf_out_body(&file_out, src, (size_t)rb);
+
+    if (res == OK && rb < 0)
+    {
+        strncpy(error_message, "crlf_file_to_file: read", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + errno;
+    }
+
+    if (res == OK)
+        res = wbuffer_flush(&file_out.W);
+
+    return res;
+}
+
+int crlf_buf_to_file(const char* in, size_t sz, file_p out)
+{
+    int res;
+
+    struct crlf_out_t buf_out;
+
+    crlf_out_init(&buf_out, out);
+
+    res = crlf_out_body(&buf_out, (const unsigned char*)in, sz);
+    if (res == OK)
+        res = wbuffer_flush(&buf_out.W);
+
+    return res;
+}
@@ -0,0 +1,44 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#ifndef CMC_EML_CRLF_H_INCLUDED
+#define CMC_EML_CRLF_H_INCLUDED
+
+#include "io.h"
+
+#include <stddef.h>
+
+/**
+ * Select the fastest scanner the CPU supports (AVX2 or SSE2 on x86, scalar
+ * otherwise); the output is the same in any case.
+ *
+ * It must be called once, at startup, before any copy.
+ */
+extern void crlf_init(void);
+
+/**
+ * Offset of the first bare <LF> among the `n` bytes at `buf`, which follow a
+ * <CR> if `after_cr`; `n` if there is none.
+ */
+extern size_t crlf_bare_lf(const char* buf, size_t n, int after_cr);
+
+/**
+ * Copy `in`, from its beginning if it is a regular file, into `out`, turning
+ * every bare <LF> into <CR><LF>; anything else, <CR><LF> included, is copied
+ * as is.
+ *
+ * The bytes of a regular `in` before its first bare <LF> need no change, thus
+ * the kernel copies them when it can. `prefix` is their count, if known
+ * already (e.g. by crlf_bare_lf, from a previous read of `in`); if -1, `in` is
+ * read once more to find it.
+ *
+ * Return:
+ * - OK;
+ * - ERRNO_SPLIT + errno, on read or write error.
+ */
+extern int crlf_file_to_file(file_p in, file_p out, off_t prefix);
+
+/** Same as crlf_file_to_file, but the input is the `sz` bytes at `in` */
+extern int crlf_buf_to_file(const char* in, size_t sz, file_p out);
+
+#endif /* CMC_EML_CRLF_H_INCLUDED */
@@ -3,4 +3,4 @@
 
 #include "error.h"
 
-char error_message[MAX_ERROR_SIZE];
+__thread char error_message[MAX_ERROR_SIZE];
@@ -29,7 +29,9 @@
 #define ERRNO_SPLIT 1000000
 
 #define MAX_ERROR_SIZE 1024
-extern char error_message[];
+
+/* Thread local, so that threads do not overwrite each other's messages */
+extern __thread char error_message[];
 
 #define return_iferr(ret)                                                      \
     {                                                                          \
@@ -0,0 +1 @@
+python3 producer.py cmc-eml-ring ./cmc-eml --shm cmc-eml-ring < test.txt
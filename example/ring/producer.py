@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+# Copyright (c) 2025 Mattia Cabrini
+# SPDX-License-Identifier: MIT
+
+"""
+Stand-in producer for the shared memory job ring (see ring.h).
+
+    producer.py NAME COMMAND [ARG...] < commands.txt
+
+Create the ring NAME, start COMMAND (e.g. ./cmc-eml --shm NAME), write each
+line of stdin, a command in the text protocol, as a binary protocol frame,
+then the end frame; wait for COMMAND and remove the ring.
+"""
+
+import ctypes
+import mmap
+import os
+import platform
+import shlex
+import struct
+import subprocess
+import sys
+
+RING_MAGIC = b"cmc-ring"
+RING_HEADER_SIZE = 64
+RING_FRAME_WRAP = 0xFFFFFFFF
+RING_SIZE = 1 << 16
+
+OFF_SIZE = 8
+OFF_HEAD = 12
+OFF_TAIL = 16
+
+FUTEX_WAIT = 0
+FUTEX_WAKE = 1
+SYS_FUTEX = {"x86_64": 202, "aarch64": 98}[platform.machine()]
+
+libc = ctypes.CDLL(None, use_errno=True)
+
+
+def futex(mm, off, op, val):
+    word = ctypes.c_uint.from_buffer(mm, off)
+    libc.syscall(SYS_FUTEX, ctypes.byref(word), op, val, None, None, 0)
+    del word
+
+
+def u32(mm, off):
+    return struct.unpack_from("=I", mm, off)[0]
+
+
+def encode(line):
+    """A text protocol command as a binary protocol command"""
+    pairs = [token.split("=", 1) for token in shlex.split(line)]
+    out = struct.pack(">I", len(pairs))
+    for pair in pairs:
+        key = pair[0].encode()
+        value = pair[1].encode() if len(pair) > 1 else b""
+        out += struct.pack(">I", len(key)) + key
+        out += struct.pack(">I", len(value)) + value
+    return out
+
+
+def push(mm, cmd):
+    """Write one frame, waiting while the ring is full"""
+    frame = (4 + len(cmd) + 3) & ~3
+
+    while True:
+        head = u32(mm, OFF_HEAD)
+        tail = u32(mm, OFF_TAIL)
+        pos = head & (RING_SIZE - 1)
+        skip = RING_SIZE - pos if pos + frame > RING_SIZE else 0
+
+        if RING_SIZE - ((head - tail) & 0xFFFFFFFF) >= skip + frame:
+            break
+
+        futex(mm, OFF_TAIL, FUTEX_WAIT, tail)
+
+    data = RING_HEADER_SIZE
+    if skip:
+        struct.pack_into(">I", mm, data + pos, RING_FRAME_WRAP)
+        pos = 0
+
+    struct.pack_into(">I", mm, data + pos, len(cmd))
+    mm[data + pos + 4:data + pos + 4 + len(cmd)] = cmd
+
+    struct.pack_into("=I", mm, OFF_HEAD, (head + skip + frame) & 0xFFFFFFFF)
+    futex(mm, OFF_HEAD, FUTEX_WAKE, 0x7FFFFFFF)
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit("Usage: %s NAME COMMAND [ARG...]" % sys.argv[0])
+
+    path = "/dev/shm/" + sys.argv[1].lstrip("/")
+    fd = os.open(path, os.O_RDWR | os.O_CREAT | os.O_TRUNC, 0o600)
+    os.ftruncate(fd, RING_HEADER_SIZE + RING_SIZE)
+    mm = mmap.mmap(fd, RING_HEADER_SIZE + RING_SIZE)
+    os.close(fd)
+
+    mm[0:len(RING_MAGIC)] = RING_MAGIC
+    struct.pack_into("=III", mm, OFF_SIZE, RING_SIZE, 0, 0)
+
+    try:
+        consumer = subprocess.Popen(sys.argv[2:])
+
+        for line in sys.stdin:
+            if line.strip():
+                push(mm, encode(line))
+
+        # A frame with length 0 ends the stream
+        push(mm, b"")
+
+        ret = consumer.wait()
+    finally:
+        mm.close()
+        os.unlink(path)
+
+    sys.exit(ret)
+
+
+if __name__ == "__main__":
+    main()
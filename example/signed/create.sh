@@ -11,7 +11,4 @@ cat ../../ignore/pass | gpg \
 	-u dev@mattiacabrini.com \
 	test.eml
 
-CR=$(printf '\r')
-sed -i "s/\$/$CR/" test.eml.asc
-
 cat test_signed.txt | ./cmc-eml
@@ -0,0 +1,192 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#include "feat.h"
+
+#include "error.h"
+#include "gz.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ZLIB_CONST
+#include <zlib.h>
+
+/* Input bytes read per step by gz_read */
+#define GZ_CHUNK 49152
+
+/* Bytes handed to zlib at once, whose counters are unsigned int */
+#define GZ_STEP 1073741824UL
+
+/* 15 is the largest window; 16 more for a gzip header and trailer */
+#define GZ_WINDOW_BITS (15 + 16)
+
+struct gz_t
+{
+    z_stream      z;
+    struct file_t in;
+    int           eof; /* `in` is over: the stream is being finished */
+    int           end; /* The stream is over */
+    unsigned char src[GZ_CHUNK];
+};
+
+/** Return OK, or ERRNO_SPLIT + ENOMEM */
+static int gz_init(z_streamp z);
+
+static int gz_init(z_streamp z)
+{
+    int res;
+
+    memset(z, 0, sizeof(*z));
+
+    res = deflateInit2(
+        z,
+        Z_DEFAULT_COMPRESSION,
+        Z_DEFLATED,
+        GZ_WINDOW_BITS,
+        8,
+        Z_DEFAULT_STRATEGY
+    );
+    if (res != Z_OK)
+    {
+        strncpy(error_message, "gz: could not set up zlib", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + ENOMEM;
+    }
+
+    return OK;
+}
+
+int gz_open(file_p F, file_p src)
+{
+    struct gz_t* G;
+    int          res;
+
+    assert(F != NULL, FATAL_LOGIC, "gz_open: invalid file");
+    assert(src != NULL, FATAL_LOGIC, "gz_open: invalid file (src)");
+
+    G = malloc(sizeof(*G));
+    if (G == NULL)
+    {
+        strncpy(error_message, "gz: could not set up zlib", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + ENOMEM;
+    }
+
+    res = gz_init(&G->z);
+    if (res != OK)
+    {
+        free(G);
+        return res;
+    }
+
+    /* F may be src itself */
+    G->in  = *src;
+    G->eof = 0;
+    G->end = 0;
+
+    file_set_fd(F, src->fd);
+    F->gz = G;
+
+    return OK;
+}
+
+ssize_t gz_read(file_p F, char* buf, size_t max)
+{
+    struct gz_t* G = F->gz;
+    ssize_t      rb;
+    int          res;
+
+    if (max == 0)
+        return 0;
+
+    G->z.next_out  = (Bytef*)buf;
+    G->z.avail_out = (uInt)(max < GZ_STEP ? max : GZ_STEP);
+
+    /* Only the end of the stream yields no byte */
+    while (!G->end && G->z.next_out == (Bytef*)buf)
+    {
+        if (G->z.avail_in == 0 && !G->eof)
+        {
+            rb = file_read(&G->in, (char*)G->src, sizeof(G->src));
+            if (rb < 0)
+                return rb;
+
+            G->eof        = rb == 0;
+            G->z.next_in  = G->src;
+            G->z.avail_in = (uInt)rb;
+        }
+
+        res = deflate(&G->z, G->eof ? Z_FINISH : Z_NO_FLUSH);
+        if (res == Z_STREAM_END)
+            G->end = 1;
+        else if (res != Z_OK && res != Z_BUF_ERROR)
+        {
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    return (ssize_t)((char*)G->z.next_out - buf);
+}
+
+void gz_close(file_p F)
+{
+    struct gz_t* G = F->gz;
+
+    deflateEnd(&G->z);
+    file_close(&G->in);
+    free(G);
+
+    F->gz = NULL;
+    F->fd = -1;
+}
+
+int gz_buf(const char* in, size_t sz, char** out, size_t* out_sz)
+{
+    z_stream z;
+    size_t   left_in = sz;
+    size_t   left_out;
+    size_t   step;
+    int      res;
+
+    res = gz_init(&z);
+    return_iferr(res);
+
+    left_out = (size_t)deflateBound(&z, (uLong)sz);
+    *out     = malloc(left_out);
+    if (*out == NULL)
+    {
+        deflateEnd(&z);
+        strncpy(error_message, "gz: could not allocate", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + ENOMEM;
+    }
+
+    z.next_in  = (const Bytef*)in;
+    z.next_out = (Bytef*)*out;
+
+    do
+    {
+        if (z.avail_in == 0)
+        {
+            step       = left_in < GZ_STEP ? left_in : GZ_STEP;
+            z.avail_in = (uInt)step;
+            left_in -= step;
+        }
+
+        if (z.avail_out == 0)
+        {
+            step        = left_out < GZ_STEP ? left_out : GZ_STEP;
+            z.avail_out = (uInt)step;
+            left_out -= step;
+        }
+
+        res = deflate(&z, left_in == 0 ? Z_FINISH : Z_NO_FLUSH);
+    } while (res == Z_OK);
+
+    *out_sz = (size_t)((char*)z.next_out - *out);
+    deflateEnd(&z);
+
+    /* deflateBound is never exceeded: nothing else may go wrong */
+    assert(res == Z_STREAM_END, FATAL_LOGIC, "gz_buf: deflate");
+
+    return OK;
+}
@@ -0,0 +1,39 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#ifndef CMC_EML_GZ_H_INCLUDED
+#define CMC_EML_GZ_H_INCLUDED
+
+#include "io.h"
+
+#include <stddef.h>
+
+#define GZ_MIME "application/gzip"
+#define GZ_SUFFIX ".gz"
+
+/**
+ * Set F to read what `src` reads, from its current offset, compressed on the
+ * fly in gzip format (RFC 1952); F takes `src` over, thus file_close(F) closes
+ * it. Memory does not depend on the size of the content.
+ *
+ * Return:
+ * - OK;
+ * - ERRNO_SPLIT + ENOMEM, if the compressor cannot be set up.
+ */
+extern int gz_open(file_p F, file_p src);
+
+/** file_read of a file set by gz_open */
+extern ssize_t gz_read(file_p F, char* buf, size_t max);
+
+/** file_close of a file set by gz_open */
+extern void gz_close(file_p F);
+
+/**
+ * Compress the `sz` bytes at `in` in gzip format into a new buffer, `*out` of
+ * `*out_sz` bytes, that the caller shall free.
+ *
+ * Return OK or ERRNO_SPLIT + ENOMEM.
+ */
+extern int gz_buf(const char* in, size_t sz, char** out, size_t* out_sz);
+
+#endif /* CMC_EML_GZ_H_INCLUDED */
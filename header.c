@@ -5,12 +5,13 @@
 #include "error.h"
 #include "util.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 void eml_header_init(eml_header_p H)
 {
-    H->key[0]   = '\0';
-    H->value[0] = '\0';
+    H->key[0] = '\0';
+    H->value  = NULL;
 }
 
 int eml_header_print(eml_header_p H, file_p F)
@@ -27,8 +28,23 @@ void eml_header_set_init(eml_header_set_p S)
         eml_header_init(S->H + cur);
 }
 
+void eml_header_set_free(eml_header_set_p S)
+{
+    int cur;
+
+    for (cur = 0; cur < S->count; ++cur)
+    {
+        free(S->H[cur].value);
+        S->H[cur].value = NULL;
+    }
+
+    S->count = 0;
+}
+
 int eml_header_set_add(eml_header_set_p S, const char* key, const char* value)
 {
+    size_t size;
+
     if (key == NULL)
     {
         strncpy(error_message, "key empty", MAX_ERROR_SIZE);
@@ -48,19 +64,21 @@ int eml_header_set_add(eml_header_set_p S, const char* key, const char* value)
         S->H[S->count].key, key, sizeof(S->H[S->count].key), "key too long"
     )
 
-    STRCPY_OR_TOOLONG(
-        S->H[S->count].value,
-        value,
-        sizeof(S->H[S->count].value),
-        "value too long"
-    )
+    size                 = strlen(value) + 1;
+    S->H[S->count].value = malloc(size);
+    if (S->H[S->count].value == NULL)
+    {
+        strncpy(error_message, "header value", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + ENOMEM;
+    }
+    memcpy(S->H[S->count].value, value, size);
 
     ++S->count;
 
     return OK;
 }
 
-int eml_header_set_add_by_command(eml_header_set_p S, const int* command)
+int eml_header_set_add_by_command(eml_header_set_p S, comm_arena_p command)
 {
     int res = OK;
 
@@ -109,21 +127,41 @@ int eml_header_set_add_by_command(eml_header_set_p S, const int* command)
     return res;
 }
 
-void eml_header_set_copy(eml_header_set_p dst, eml_header_set_p src)
+int eml_header_set_copy(eml_header_set_p dst, eml_header_set_p src)
 {
-    memcpy(dst, src, sizeof(struct eml_header_set_t));
+    int ret = OK;
+    int cur;
+
+    eml_header_set_init(dst);
+
+    for (cur = 0; ret == OK && cur < src->count; ++cur)
+        ret = eml_header_set_add(dst, src->H[cur].key, src->H[cur].value);
+
+    if (ret != OK)
+        eml_header_set_free(dst);
+
+    return ret;
 }
 
 int eml_header_set_print(eml_header_set_p S, file_p F)
 {
-    int ret = OK;
-    int cur;
+    int                 ret = OK;
+    int                 cur;
+    struct file_batch_t B;
+
+    /* One writev for the whole set, unless it has many headers */
+    file_batch_init(&B, F);
 
     for (cur = 0; ret == OK && cur < S->count; ++cur)
-        ret = eml_header_print(S->H + cur, F);
+        ret = file_batch_addv(
+            &B, S->H[cur].key, ": ", S->H[cur].value, "\r\n", NULL
+        );
+
+    if (ret == OK)
+        ret = file_batch_add(&B, "\r\n", 2);
 
     if (ret == OK)
-        ret = file_write_strv(F, "\r\n", NULL);
+        ret = file_batch_flush(&B);
 
     return ret;
 }
@@ -5,7 +5,6 @@
 #define CMC_EML_HEADER_H_INCLUDED
 
 #define MAX_HEADER_KEY_SIZE 64
-#define MAX_HEADER_VALUE_SIZE (4096 - 64)
 #define MAX_HEADERS 64
 
 #include "comm.h"
@@ -13,8 +12,8 @@
 
 typedef struct eml_header_t
 {
-    char key[MAX_HEADER_KEY_SIZE];
-    char value[MAX_HEADER_VALUE_SIZE];
+    char  key[MAX_HEADER_KEY_SIZE];
+    char* value; /* On the heap, of any length (e.g. To with many recipients) */
 }* eml_header_p;
 
 typedef struct eml_header_set_t
@@ -27,10 +26,19 @@ extern void eml_header_init(eml_header_p);
 extern int  eml_header_print(eml_header_p, file_p F);
 
 extern void eml_header_set_init(eml_header_set_p);
-extern void eml_header_set_copy(eml_header_set_p dst, eml_header_set_p src);
+extern void eml_header_set_free(eml_header_set_p);
+
+/**
+ * Copy src into dst, values included; dst shall be released by
+ * eml_header_set_free.
+ *
+ * Return OK, or ERRNO_SPLIT + ENOMEM: dst is then empty.
+ */
+extern int eml_header_set_copy(eml_header_set_p dst, eml_header_set_p src);
 extern int
 eml_header_set_add(eml_header_set_p, const char* key, const char* value);
-extern int eml_header_set_add_by_command(eml_header_set_p, const int* command);
+extern int
+eml_header_set_add_by_command(eml_header_set_p, comm_arena_p command);
 extern int eml_header_set_print(eml_header_set_p, file_p F);
 
 #endif /* CMC_EML_HEADER_H_INCLUDED */
@@ -3,21 +3,62 @@
 
 #include "feat.h"
 
+#include "charset.h"
 #include "error.h"
+#include "gz.h"
 #include "io.h"
+#include "uring.h"
 #include "util.h"
 
 #include <fcntl.h>
 #include <stdarg.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+
+/* Bytes handed to the kernel at once */
+#define FILE_KERNEL_CHUNK 1073741824L
+#endif
+
+/** read(2), or uring_read if F reads ahead */
+static ssize_t file_read_raw(file_p F, char* buf, size_t max);
+
+/** file_read of a file with a charset */
+static ssize_t file_read_charset(file_p F, char* buf, size_t max);
+
+/**
+ * Copy `left` bytes, or all of them if negative, from the file offset of src
+ * into dst; fewer if src ends first.
+ */
+static int file_copy_left(file_p dst, file_p src, off_t left);
+
+#ifdef __linux__
+/**
+ * Copy from src into dst in the kernel, with no user-space buffer:
+ * copy_file_range between regular files, splice if either end is a pipe,
+ * sendfile from a regular file into anything else (e.g. a socket). *left is
+ * the number of bytes to copy, negative for all of them, and is decreased as
+ * they are copied.
+ *
+ * Return OK once done, or NOT_FOUND if the kernel cannot (or can no longer)
+ * copy: the caller shall copy what is left by read and write.
+ */
+static int file_copy_kernel(file_p dst, file_p src, off_t* left);
+#endif
+
 void file_set_null(file_p F)
 {
     if (F == NULL)
         return;
 
-    F->fd = -1;
+    F->fd      = -1;
+    F->mode    = FILE_MODE_STREAM;
+    F->charset = CHARSET_UTF8;
+    F->gz      = NULL;
+    F->ur      = NULL;
 }
 
 int file_is_init(file_p F)
@@ -32,7 +73,11 @@ int file_open(file_p F, const char* path, int flags, mode_t mode)
 {
     assert(F != NULL, FATAL_LOGIC, "file_open: invalid file");
 
-    F->fd = open(path, flags, mode);
+    F->fd      = open(path, flags, mode);
+    F->mode    = FILE_MODE_STREAM;
+    F->charset = CHARSET_UTF8;
+    F->gz      = NULL;
+    F->ur      = NULL;
 
     if (F->fd < 0)
         return errno + ERRNO_SPLIT;
@@ -57,7 +102,11 @@ int file_open_tmp(file_p F)
 
     assert(F != NULL, FATAL_LOGIC, "file_open_tmp: invalid file");
 
-    F->fd = mkstemp(template);
+    F->fd      = mkstemp(template);
+    F->mode    = FILE_MODE_STREAM;
+    F->charset = CHARSET_UTF8;
+    F->gz      = NULL;
+    F->ur      = NULL;
     if (F->fd < 0)
         return errno + ERRNO_SPLIT;
 
@@ -74,17 +123,82 @@ int file_open_tmp(file_p F)
     return OK;
 }
 
+int file_open_mem(file_p F)
+{
+    assert(F != NULL, FATAL_LOGIC, "file_open_mem: invalid file");
+
+#ifdef __linux__
+    F->fd      = memfd_create("cmc-eml", MFD_CLOEXEC);
+    F->mode    = FILE_MODE_STREAM;
+    F->charset = CHARSET_UTF8;
+    F->gz      = NULL;
+    F->ur      = NULL;
+    if (F->fd >= 0)
+        return OK;
+#endif
+
+    return file_open_tmp(F);
+}
+
 void file_set_fd(file_p F, int fd)
 {
     assert(F != NULL, FATAL_LOGIC, "file_set_fd: invalid file");
 
-    F->fd = fd;
+    F->fd      = fd;
+    F->mode    = FILE_MODE_STREAM;
+    F->charset = CHARSET_UTF8;
+    F->gz      = NULL;
+    F->ur      = NULL;
+}
+
+void file_set_at(file_p F, file_p src, off_t off)
+{
+    assert(F != NULL, FATAL_LOGIC, "file_set_at: invalid file");
+    assert(src != NULL, FATAL_LOGIC, "file_set_at: invalid file (src)");
+
+    F->fd      = src->fd;
+    F->mode    = FILE_MODE_AT;
+    F->charset = CHARSET_UTF8;
+    F->gz      = NULL;
+    F->ur      = NULL;
+    F->at      = off;
+}
+
+void file_set_count(file_p F)
+{
+    assert(F != NULL, FATAL_LOGIC, "file_set_count: invalid file");
+
+    F->fd      = -1;
+    F->mode    = FILE_MODE_COUNT;
+    F->charset = CHARSET_UTF8;
+    F->gz      = NULL;
+    F->ur      = NULL;
+    F->at      = 0;
+}
+
+void file_set_charset(file_p F, file_p src, int charset)
+{
+    assert(F != NULL, FATAL_LOGIC, "file_set_charset: invalid file");
+    assert(src != NULL, FATAL_LOGIC, "file_set_charset: invalid file (src)");
+
+    F->fd      = src->fd;
+    F->mode    = FILE_MODE_STREAM;
+    F->charset = charset;
+    F->gz      = NULL;
+    F->ur      = src->ur;
+    F->nheld   = 0;
 }
 
 ssize_t file_read(file_p F, char* buf, size_t max)
 {
     assert(F != NULL, FATAL_LOGIC, "file_read: invalid file");
-    F->last_rb = read(F->fd, buf, max);
+
+    if (F->gz != NULL)
+        F->last_rb = gz_read(F, buf, max);
+    else if (F->charset == CHARSET_UTF8)
+        F->last_rb = file_read_raw(F, buf, max);
+    else
+        F->last_rb = file_read_charset(F, buf, max);
 
 #ifdef DEBUG
     fprintf(stderr, "DEBUG read %d bytes from fd %d\n", (int)F->last_rb, F->fd);
@@ -93,6 +207,58 @@ ssize_t file_read(file_p F, char* buf, size_t max)
     return F->last_rb;
 }
 
+static ssize_t file_read_raw(file_p F, char* buf, size_t max)
+{
+    if (F->ur != NULL)
+        return uring_read(F, buf, max);
+
+    return read(F->fd, buf, max);
+}
+
+static ssize_t file_read_charset(file_p F, char* buf, size_t max)
+{
+    char    one[CHARSET_MAX_GROWTH];
+    ssize_t rb;
+    size_t  n;
+
+    if (F->nheld == 0 && max >= CHARSET_MAX_GROWTH)
+    {
+        /* What is read grows in place, up to max bytes */
+        rb = file_read_raw(F, buf, max / CHARSET_MAX_GROWTH);
+        if (rb <= 0)
+            return rb;
+
+        return (ssize_t)charset_to_utf8_inplace(
+            F->charset, buf, (size_t)rb, max
+        );
+    }
+
+    /* Too little room for the next char: what does not fit is held over */
+    if (F->nheld == 0 && max > 0)
+    {
+        rb = file_read_raw(F, one, 1);
+        if (rb <= 0)
+            return rb;
+
+        F->nheld = charset_to_utf8_inplace(F->charset, one, 1, sizeof(one));
+        memcpy(F->held, one, F->nheld);
+    }
+
+    n = F->nheld < max ? F->nheld : max;
+    memcpy(buf, F->held, n);
+    memmove(F->held, F->held + n, F->nheld - n);
+    F->nheld -= n;
+
+    return (ssize_t)n;
+}
+
+ssize_t file_pread(file_p F, char* buf, size_t max, off_t off)
+{
+    assert(F != NULL, FATAL_LOGIC, "file_pread: invalid file");
+
+    return pread(F->fd, buf, max, off);
+}
+
 int file_write(file_p F, const char* buf, size_t count)
 {
     size_t  written = 0;
@@ -101,12 +267,24 @@ int file_write(file_p F, const char* buf, size_t count)
 
     assert(F != NULL, FATAL_LOGIC, "file_write: invalid file");
 
+    if (F->mode == FILE_MODE_COUNT)
+    {
+        F->at += (off_t)count;
+        return OK;
+    }
+
     while (written < count)
     {
-        res = write(F->fd, buf + written, count - written);
+        if (F->mode == FILE_MODE_AT)
+            res = pwrite(F->fd, buf + written, count - written, F->at);
+        else
+            res = write(F->fd, buf + written, count - written);
+
         if (res > 0)
         {
             written = written + (size_t)res;
+            if (F->mode == FILE_MODE_AT)
+                F->at += res;
             continue;
         }
 
@@ -154,30 +332,145 @@ int file_write_str(file_p F, const char* str)
 
 int file_write_strv(file_p F, ...)
 {
-    va_list     args;
-    const char* str;
-    int         res = OK;
+    va_list             args;
+    const char*         str;
+    struct file_batch_t B;
+    int                 res = OK;
 
     assert(F != NULL, FATAL_LOGIC, "file_write_strv: invalid file");
 
+    file_batch_init(&B, F);
+
     va_start(args, F);
 
-    while ((str = va_arg(args, const char*)) != NULL)
+    while (res == OK && (str = va_arg(args, const char*)) != NULL)
+        res = file_batch_add(&B, str, strlen(str) * sizeof(char));
+
+    va_end(args);
+
+    if (res == OK)
+        res = file_batch_flush(&B);
+
+    return res;
+}
+
+void file_batch_init(file_batch_p B, file_p F)
+{
+    assert(F != NULL, FATAL_LOGIC, "file_batch_init: invalid file");
+
+    B->F = F;
+    B->n = 0;
+}
+
+int file_batch_add(file_batch_p B, const char* buf, size_t count)
+{
+    int res;
+
+    if (count == 0)
+        return OK;
+
+    if (B->n == FILE_BATCH_IOV)
     {
-        res = file_write_str(F, str);
-        if (res != OK)
-            break;
+        res = file_batch_flush(B);
+        return_iferr(res);
     }
 
+    B->iov[B->n].iov_base = (void*)buf;
+    B->iov[B->n].iov_len  = count;
+    ++B->n;
+
+    return OK;
+}
+
+int file_batch_addv(file_batch_p B, ...)
+{
+    va_list     args;
+    const char* str;
+    int         res = OK;
+
+    va_start(args, B);
+
+    while (res == OK && (str = va_arg(args, const char*)) != NULL)
+        res = file_batch_add(B, str, strlen(str) * sizeof(char));
+
     va_end(args);
+
     return res;
 }
 
+int file_batch_flush(file_batch_p B)
+{
+    struct iovec* iov      = B->iov;
+    int           n        = B->n;
+    int           errcount = 0;
+    ssize_t       res;
+    size_t        total = 0;
+    int           i;
+
+    B->n = 0;
+
+    if (B->F->mode == FILE_MODE_COUNT)
+    {
+        for (i = 0; i < n; ++i)
+            total += iov[i].iov_len;
+
+        B->F->at += (off_t)total;
+        return OK;
+    }
+
+    while (n > 0)
+    {
+        if (B->F->mode == FILE_MODE_AT)
+            res = pwritev(B->F->fd, iov, n, B->F->at);
+        else
+            res = writev(B->F->fd, iov, n);
+
+        if (res > 0)
+        {
+            if (B->F->mode == FILE_MODE_AT)
+                B->F->at += res;
+
+            /* Skip what has been written, in part if need be */
+            for (; n > 0 && (size_t)res >= iov->iov_len; ++iov, --n)
+                res -= (ssize_t)iov->iov_len;
+
+            if (n > 0)
+            {
+                iov->iov_base = (char*)iov->iov_base + res;
+                iov->iov_len -= (size_t)res;
+            }
+
+            continue;
+        }
+
+        if (res == 0)
+            return EIO + ERRNO_SPLIT;
+
+        switch (errno)
+        {
+        case EINTR:
+            if (errcount < 10)
+            {
+                ++errcount;
+                continue;
+            }
+            return errno + ERRNO_SPLIT;
+
+        case EAGAIN:
+            /* case EWOULDBLOCK: */
+            continue;
+
+        default:
+            return errno + ERRNO_SPLIT;
+        }
+    }
+
+    return OK;
+}
+
 int file_copy(file_p dst, file_p src)
 {
-    int     res;
-    ssize_t sz;
-    char    buf[8192];
+    int res;
 
     assert(dst != NULL, FATAL_LOGIC, "file_copy: invalid file (dst)");
     assert(src != NULL, FATAL_LOGIC, "file_copy: invalid file (src)");
@@ -189,23 +482,123 @@ int file_copy(file_p dst, file_p src)
             return res;
     }
 
-    while ((sz = file_read(src, buf, sizeof(buf))) > 0)
+    return file_copy_left(dst, src, -1);
+}
+
+int file_copy_n(file_p dst, file_p src, off_t n)
+{
+    assert(dst != NULL, FATAL_LOGIC, "file_copy_n: invalid file (dst)");
+    assert(src != NULL, FATAL_LOGIC, "file_copy_n: invalid file (src)");
+    assert(n >= 0, FATAL_LOGIC, "file_copy_n: n < 0");
+
+    return file_copy_left(dst, src, n);
+}
+
+static int file_copy_left(file_p dst, file_p src, off_t left)
+{
+    int     res;
+    ssize_t sz = 0;
+    size_t  max;
+    char    buf[8192];
+
+#ifdef __linux__
+    if (file_copy_kernel(dst, src, &left) == OK)
+        return OK;
+#endif
+
+    while (left != 0)
     {
-        res = file_write(dst, buf, (size_t)sz);
+        max = left < 0 || left > (off_t)sizeof(buf) ? sizeof(buf)
+                                                    : (size_t)left;
+
+        sz  = file_read(src, buf, max);
+        if (sz <= 0)
+            break;
 
+        res = file_write(dst, buf, (size_t)sz);
         if (res != OK)
             return res;
+
+        if (left > 0)
+            left -= sz;
     }
 
-    if (sz < 0)
+    if (left != 0 && sz < 0)
         return errno + ERRNO_SPLIT;
 
     return OK;
 }
 
+#ifdef __linux__
+static int file_copy_kernel(file_p dst, file_p src, off_t* left)
+{
+    struct stat s_src;
+    struct stat s_dst;
+    loff_t      at = (loff_t)dst->at;
+    loff_t*     off_dst;
+    size_t      n;
+    ssize_t     res;
+
+    /* Only bytes of the file as they are, into a file that is written */
+    if (src->charset != CHARSET_UTF8 || src->gz != NULL ||
+        dst->mode == FILE_MODE_COUNT)
+        return NOT_FOUND;
+
+    if (fstat(src->fd, &s_src) != 0 || fstat(dst->fd, &s_dst) != 0)
+        return NOT_FOUND;
+
+    /* The kernel copies from the file offset */
+    if (src->ur != NULL && uring_sync(src) != OK)
+        return NOT_FOUND;
+
+    off_dst = dst->mode == FILE_MODE_AT ? &at : NULL;
+
+    /* sendfile has no output offset; splice has none into a pipe */
+    if (off_dst != NULL && !S_ISREG(s_dst.st_mode))
+        return NOT_FOUND;
+    if (!S_ISREG(s_src.st_mode) && !S_ISFIFO(s_src.st_mode) &&
+        !S_ISFIFO(s_dst.st_mode))
+        return NOT_FOUND;
+
+    while (*left != 0)
+    {
+        n = *left < 0 || *left > FILE_KERNEL_CHUNK ? (size_t)FILE_KERNEL_CHUNK
+                                                   : (size_t)*left;
+
+        if (S_ISREG(s_src.st_mode) && S_ISREG(s_dst.st_mode))
+            res = copy_file_range(src->fd, NULL, dst->fd, off_dst, n, 0);
+        else if (S_ISFIFO(s_src.st_mode) || S_ISFIFO(s_dst.st_mode))
+            res = splice(src->fd, NULL, dst->fd, off_dst, n, SPLICE_F_MOVE);
+        else
+            res = sendfile(dst->fd, src->fd, NULL, n);
+
+        if (res == 0)
+            break;
+
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            /* Nothing has been copied by the failed call: read and write go
+             * on from where the kernel stopped */
+            return NOT_FOUND;
+        }
+
+        if (*left > 0)
+            *left -= res;
+        if (off_dst != NULL)
+            dst->at = (off_t)at;
+    }
+
+    return OK;
+}
+#endif
+
 int file_seek(file_p F, off_t off, int whence)
 {
     off_t out;
+    int   res;
 
     assert(F != NULL, FATAL_LOGIC, "file_seek: invalid file");
 
@@ -219,6 +612,13 @@ int file_seek(file_p F, off_t off, int whence)
     );
 #endif
 
+    /* The file offset is what has been read, not what is in flight */
+    if (F->ur != NULL)
+    {
+        res = uring_sync(F);
+        return_iferr(res);
+    }
+
     out = lseek(F->fd, off, whence);
     if (out == -1)
         return errno + ERRNO_SPLIT;
@@ -239,6 +639,9 @@ off_t file_cur(file_p F)
     );
 #endif
 
+    if (F->ur != NULL && uring_sync(F) != OK)
+        return -1;
+
     return lseek(F->fd, 0, SEEK_CUR);
 }
 
@@ -249,16 +652,85 @@ int file_isreg(file_p F)
 
     assert(F != NULL, FATAL_LOGIC, "file_isreg: invalid file");
 
+    /* Not as far as callers can tell: sizes and offsets are not those read */
+    if (F->charset != CHARSET_UTF8 || F->gz != NULL)
+        return 0;
+
     res = fstat(F->fd, &s);
     assert(res == 0, errno + ERRNO_SPLIT, "file_isreg: fstat: could not stat");
 
     return S_ISREG(s.st_mode);
 }
 
+int file_isappend(file_p F)
+{
+    int flags;
+
+    assert(F != NULL, FATAL_LOGIC, "file_isappend: invalid file");
+
+    flags = fcntl(F->fd, F_GETFL);
+
+    /* Unknown: assume the worst */
+    return flags == -1 || (flags & O_APPEND) != 0;
+}
+
+int file_map(file_p F, const char** map, size_t* size)
+{
+    off_t size_off;
+    void* addr;
+
+    assert(F != NULL, FATAL_LOGIC, "file_map: invalid file");
+
+    if (!file_isreg(F))
+        return NOT_FOUND;
+
+    size_off = file_size(F);
+    if (size_off <= 0 || (off_t)(size_t)size_off != size_off)
+        return NOT_FOUND;
+
+    addr = mmap(NULL, (size_t)size_off, PROT_READ, MAP_PRIVATE, F->fd, 0);
+    if (addr == MAP_FAILED)
+        return NOT_FOUND;
+
+    /* Hints only: they may well be refused */
+    madvise(addr, (size_t)size_off, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(addr, (size_t)size_off, MADV_HUGEPAGE);
+#endif
+
+    *map  = addr;
+    *size = (size_t)size_off;
+
+    return OK;
+}
+
+void file_unmap(const char* map, size_t size) { munmap((void*)map, size); }
+
+off_t file_size(file_p F)
+{
+    struct stat s;
+
+    assert(F != NULL, FATAL_LOGIC, "file_size: invalid file");
+
+    if (fstat(F->fd, &s) != 0)
+        return -1;
+
+    return s.st_size;
+}
+
 void file_close(file_p F)
 {
     assert(F != NULL, FATAL_LOGIC, "file_close: invalid file");
 
+    if (F->gz != NULL)
+    {
+        gz_close(F);
+        return;
+    }
+
+    if (F->ur != NULL)
+        uring_close(F);
+
     close(F->fd);
     F->fd = -1;
 }
@@ -6,16 +6,49 @@
 
 #include "feat.h"
 
+#include "charset.h"
+
 #include <stddef.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+/* How file_write writes */
+#define FILE_MODE_STREAM 0 /* write(2) at the file offset */
+#define FILE_MODE_AT 1     /* pwrite(2) at `at`, which then moves on */
+#define FILE_MODE_COUNT 2  /* Nothing is written: `at` counts bytes */
+
+struct gz_t;
+struct uring_t;
+
 typedef struct file_t
 {
     int     fd;
     ssize_t last_rb; /* Undefined behaviour if no read has been attempted yet */
+    int     mode;    /* FILE_MODE_* */
+    off_t   at;
+    int     charset; /* CHARSET_* of the content, transcoded by file_read */
+    char    held[CHARSET_MAX_GROWTH]; /* UTF-8 left over by a short read */
+    size_t  nheld;
+
+    struct gz_t*    gz; /* Set by gz_open: file_read compresses what it reads */
+    struct uring_t* ur; /* Set by uring_open: reads are submitted ahead */
 }* file_p;
 
+/* Pieces held by a batch before it is flushed */
+#define FILE_BATCH_IOV 64
+
+/**
+ * Pieces to write with a single writev(2) (pwritev(2) for FILE_MODE_AT): they
+ * are not copied, thus they shall outlive the flush.
+ */
+typedef struct file_batch_t
+{
+    file_p       F;
+    struct iovec iov[FILE_BATCH_IOV];
+    int          n;
+}* file_batch_p;
+
 extern void file_set_null(file_p F);
 extern int  file_is_init(file_p F);
 
@@ -23,18 +56,92 @@ extern int  file_open(file_p F, const char* path, int flags, mode_t mode);
 extern int  file_open_tmp(file_p F);
 extern void file_set_fd(file_p, int fd);
 
+/**
+ * Open an anonymous regular file that lives in memory (memfd_create on Linux);
+ * file_open_tmp is the fallback.
+ */
+extern int file_open_mem(file_p F);
+
+/**
+ * Set F to write to the same file as `src`, starting at offset `off` and
+ * regardless of the file offset; thus threads can write to different regions
+ * of the same file at once. `src` shall not be in append mode (see
+ * file_isappend).
+ */
+extern void file_set_at(file_p F, file_p src, off_t off);
+
+/** Set F to discard what is written, only counting bytes in F->at */
+extern void file_set_count(file_p F);
+
+/**
+ * Set F to read from the same file as `src`, transcoding its content from
+ * `charset` to UTF-8 on the fly. Sizes and offsets of the file do not match
+ * what is read, thus F is not regular for file_isreg.
+ */
+extern void file_set_charset(file_p F, file_p src, int charset);
+
+/**
+ * Read up to `max` bytes; a file with a charset reads at most
+ * max / CHARSET_MAX_GROWTH bytes of the file each time, and 0 only at its end.
+ */
 extern ssize_t file_read(file_p F, char* buf, size_t max);
 
+/** Read at offset `off`, without moving the file offset (pread) */
+extern ssize_t file_pread(file_p F, char* buf, size_t max, off_t off);
+
 extern int file_write(file_p F, const char* buf, size_t count);
 extern int file_write_str(file_p F, const char* str);
 extern int file_write_strv(file_p F, ...);
 
+/** Bind B to F, with no pieces */
+extern void file_batch_init(file_batch_p B, file_p F);
+
+/** Add `count` bytes at `buf`; the batch is flushed first if full */
+extern int file_batch_add(file_batch_p B, const char* buf, size_t count);
+
+/** Add the strings that follow B, up to a NULL */
+extern int file_batch_addv(file_batch_p B, ...);
+
+/**
+ * Write what B holds, as file_write would, and empty it.
+ *
+ * Return OK, or ERRNO_SPLIT + errno on write error.
+ */
+extern int file_batch_flush(file_batch_p B);
+
+/**
+ * Copy src, from its beginning if it is a regular file, into dst.
+ *
+ * On Linux, the copy happens in the kernel when it can (see file_copy_n); read
+ * and write, through a user-space buffer, are the fallback.
+ */
 extern int file_copy(file_p dst, file_p src);
 
+/**
+ * Copy `n` bytes, fewer if src ends first, from the file offset of src into
+ * dst: copy_file_range between regular files, splice if either is a pipe,
+ * sendfile into anything else; read and write if none applies or the kernel
+ * refuses (e.g. EXDEV, EINVAL), as for a file with a charset or a counter.
+ */
+extern int file_copy_n(file_p dst, file_p src, off_t n);
+
 extern int   file_seek(file_p F, off_t off, int whence);
 extern off_t file_cur(file_p F);
 
+/**
+ * Map the whole of F, read-only, hinted for a sequential read (and huge pages,
+ * where supported), into *map of *size bytes; it shall be released by
+ * file_unmap. F shall not shrink while mapped.
+ *
+ * Return OK, or NOT_FOUND if F cannot be mapped: it is not regular (see
+ * file_isreg), it is empty or mmap fails. The caller shall then read F.
+ */
+extern int  file_map(file_p F, const char** map, size_t* size);
+extern void file_unmap(const char* map, size_t size);
+
 extern int     file_isreg(file_p F);
+extern int     file_isappend(file_p F); /* O_APPEND: pwrite ignores offsets */
+extern off_t   file_size(file_p F);     /* -1 on error */
 extern ssize_t file_last_rb(file_p F);
 
 extern void file_close(file_p F);
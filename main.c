@@ -6,27 +6,49 @@
 #include "feat.h"
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <unistd.h>
 
 #include "attachment.h"
 #include "base64.h"
+#include "charset.h"
 #include "comm.h"
+#include "crlf.h"
+#include "cqueue.h"
 #include "error.h"
 #include "header.h"
 #include "io.h"
+#include "qp.h"
+#include "ring.h"
+#include "scan.h"
+#include "uring.h"
 #include "util.h"
 
+/* Upper bound for --threads */
+#define MAX_THREADS 256
+
 #define MAIN_BODY_CLEAR "This is a multi-part message in MIME format.\r\n"
 #define MAIN_BODY_SIGN                                                         \
     "This is an OpenPGP/MIME signed message (RFC 4880 and 3156)\r\n"
 
 typedef struct global_data_t
 {
-    struct file_t stdin_f;
+    struct file_t    stdin_f;
+    struct rbuffer_t stdin_b;   /* Command read-ahead; survives `clear` */
+    int              comm_mode; /* COMM_MODE_TEXT or COMM_MODE_BIN */
+    struct ring_t    ring;      /* Used instead of stdin if use_ring */
+    int              use_ring;
+    struct file_t    ack_f;     /* Used to acknowledge commands if use_ack */
+    int              use_ack;
+
+    /* Pipelined mode: the parser thread fills Q, main executes from it */
+    int              pipelined;
+    struct cqueue_t  Q;
+    pthread_t        parser;
+    cqueue_slot_p    slot; /* Command being executed */
 
     struct eml_header_set_t S;
     struct att_set_t        A;
@@ -35,26 +57,204 @@ typedef struct global_data_t
 
 static void global_data_init(global_data_p);
 
-static int print_clear_eml_by_command(global_data_p GD, int* comm_arena);
-static int print_signed_eml_by_command(global_data_p GD, int* comm_arena);
+/**
+ * Read the next command from the transport in use (stdin or ring).
+ *
+ * On error, *in_sync tells whether the transport can go on with the following
+ * command: a malformed ring frame does not affect the following ones and, if
+ * commands are acknowledged, the rest of a malformed text line is skipped.
+ */
+static int
+next_command(global_data_p GD, comm_arena_p comm_arena, int* in_sync);
+
+/**
+ * Get the next command to execute into *comm_arena: if pipelined, the oldest
+ * command parsed ahead by the parser thread; otherwise, the command read into
+ * `own` by next_command.
+ */
+static int fetch_command(
+    global_data_p GD, comm_arena_p own, comm_arena_p* comm_arena, int* in_sync
+);
+
+/**
+ * Parser thread body: parse commands, and their inline blocks, ahead into
+ * GD->Q until the last one.
+ */
+static void* parse_ahead(void* arg);
+
+/** Parse the next command, and its inline block if any, into `slot` */
+static void parse_slot(global_data_p GD, cqueue_slot_p slot);
+
+/** Tell whether the command stream in use (stdin or ring) is over */
+static int end_of_stream(global_data_p GD);
+
+/** Tell whether no command follows the one fetched last */
+static int end_of_commands(global_data_p GD);
+
+static int add_header_by_command(global_data_p GD, comm_arena_p comm_arena);
+static int add_attachment_by_command(global_data_p GD, comm_arena_p comm_arena);
+static int set_body_by_command(global_data_p GD, comm_arena_p comm_arena);
+static int
+print_clear_eml_by_command(global_data_p GD, comm_arena_p comm_arena);
+static int
+print_signed_eml_by_command(global_data_p GD, comm_arena_p comm_arena);
+static int clear_by_command(global_data_p GD, comm_arena_p comm_arena);
+
+/** Add an attachment or the body, reading its inline block if any */
+static int
+add_part_by_command(global_data_p GD, comm_arena_p comm_arena, int is_body);
+
+/**
+ * Read the inline block that follows the current command: from stdin, right
+ * after the command; from the ring, as the next frame. If `dst` is NULL, the
+ * block is discarded.
+ */
+static int
+read_block(global_data_p GD, comm_arena_p comm_arena, char* dst, size_t sz);
+
+/**
+ * Acknowledge a command on GD->ack_f with a line that follows the text
+ * protocol:
+ *
+ *   id="ID" status=ok
+ *   id="ID" status=error code=CODE message="MESSAGE"
+ *
+ * `id` is the value of the command `id` key; if NULL, the `id` key is omitted.
+ * CODE is one of the codes in error.h.
+ */
+static int ack_command(global_data_p GD, const char* id, int code);
+
+/** Write `str` escaped as a text protocol quoted value, without the quotes */
+static int ack_write_quoted(file_p F, const char* str);
+
+/** Parse the command line; return OK or FATAL_PARAM */
+static int parse_args(
+    global_data_p GD, int argc, char** argv, char** shm, size_t* depth
+);
+
+/* `do=` verbs */
+enum
+{
+    VERB_QUIT,
+    VERB_ADD_HEADER,
+    VERB_ADD_ATTACHMENT,
+    VERB_SET_BODY,
+    VERB_PRINT_CLEAR_EML,
+    VERB_PRINT_SIGNED_EML,
+    VERB_CLEAR,
+    VERB_COUNT
+};
+
+typedef struct verb_t
+{
+    const char* name;
+    int (*exec)(global_data_p GD, comm_arena_p comm_arena);
+}* verb_p;
+
+static const struct verb_t VERBS[VERB_COUNT] = {
+    {"quit", NULL},
+    {"add-header", add_header_by_command},
+    {"add-attachment", add_attachment_by_command},
+    {"set-body", set_body_by_command},
+    {"print-clear-eml", print_clear_eml_by_command},
+    {"print-signed-eml", print_signed_eml_by_command},
+    {"clear", clear_by_command}
+};
+
+/**
+ * Perfect hash on the verb length: all verbs have different lengths, so one
+ * strcmp is enough to confirm a match.
+ *
+ * Return the verb index in VERBS or -1 if the verb is not implemented.
+ */
+static int verb_lookup(const char* name);
 
 static int print_eml_a(
     eml_header_set_p S, att_set_p A, file_p out, const char* mimebody, int sign
 );
 
+/* Output of a print command */
+typedef struct output_t
+{
+    struct file_t F;     /* Where the message goes */
+    struct file_t spool; /* Where it is printed first, if framed */
+    int           owned; /* F has been opened by output_open: close it */
+    int           framed;
+}* output_p;
+
+/**
+ * Open the output of a print command:
+ * - `path=-`: stdout;
+ * - `fd=N`: the inherited descriptor N;
+ * - `path=PATH`: PATH, created or truncated.
+ *
+ * With `frame=length`, for stdout and descriptors only, the message is printed
+ * into an in-memory spool and then copied, preceded by its length as 4 bytes,
+ * unsigned, big endian; thus many messages can flow on the same stream.
+ *
+ * Set *print to the file to print the message into.
+ */
+static int output_open(output_p O, comm_arena_p comm_arena, file_p* print);
+
+/** Send the spooled message, if framed, and close what output_open opened */
+static int output_close(output_p O, int res);
+
 int main(int argc, char** argv)
 {
     int ret = OK;
 
     struct global_data_t GD;
     struct comm_t        command;
-    int                  comm_arena[1024];
-
-    (void)argc;
-    (void)argv;
+    struct comm_t        id_c;
+    struct comm_arena_t  arena;
+    comm_arena_p         comm_arena;
+    int                  verb;
+    int                  in_sync;
+    char*                shm   = NULL;
+    size_t               depth = 0;
 
-    srand((unsigned int)(time(NULL) + getpid()));
+    base64_init();
+    qp_init();
+    scan_init();
+    crlf_init();
+    charset_init();
     global_data_init(&GD);
+    file_set_fd(&GD.stdin_f, STDIN_FILENO);
+    rbuffer_init(&GD.stdin_b, &GD.stdin_f);
+
+    /* The ring is already a queue filled ahead by the producer */
+    if (parse_args(&GD, argc, argv, &shm, &depth) != OK ||
+        (shm != NULL && depth > 0))
+    {
+        fprintf(
+            stderr,
+            "Usage: %s [--shm NAME | --pipeline DEPTH] [--ack FD] "
+            "[--threads N] [--io sync|uring]\n",
+            argv[0]
+        );
+        return FATAL_PARAM;
+    }
+
+    GD.use_ring = shm != NULL;
+    if (GD.use_ring)
+        ret = ring_attach(&GD.ring, shm);
+    else
+        ret = comm_open(&GD.stdin_b, &GD.comm_mode);
+    assert(ret == OK, ret, error_message);
+
+    ret = comm_arena_init(&arena);
+    assert(ret == OK, ret, "could not allocate command arena");
+
+    GD.pipelined = depth > 0;
+    GD.slot      = NULL;
+    if (GD.pipelined)
+    {
+        ret = cqueue_init(&GD.Q, (unsigned int)depth);
+        assert(ret == OK, ret, error_message);
+
+        ret = pthread_create(&GD.parser, NULL, parse_ahead, &GD);
+        assert(ret == 0, ERRNO_SPLIT + ret, "could not start parser thread");
+    }
 
 #ifdef DEBUG
     base64_test_ALPHABET();
@@ -62,39 +262,60 @@ int main(int argc, char** argv)
 
     do
     {
-        ret = comm_next(&GD.stdin_f, comm_arena, 1024);
-        assert(ret == OK, ret, error_message);
+        ret = fetch_command(&GD, &arena, &comm_arena, &in_sync);
 
-        if (comm_get(comm_arena, "do", &command) == NOT_FOUND ||
-            command.value == NULL)
+        /* With acknowledgements, errors are reported and commands go on */
+        if (ret != OK && GD.use_ack && in_sync)
         {
-            assert(0, FATAL_LOGIC, "No `do` command provided.");
+            ret = ack_command(&GD, NULL, ret);
+            assert(ret == OK, ret, "could not acknowledge command");
             continue;
         }
 
-        STR_SWITCH_INIT()
+        assert(ret == OK, ret, error_message);
 
-        STR_IF_EQ(command.value, "quit") break;
+        if (comm_get(comm_arena, "id", &id_c) == NOT_FOUND)
+            id_c.value = NULL;
 
-        STR_IF_EQ(command.value, "add-header")
-        ret = eml_header_set_add_by_command(&GD.S, comm_arena);
+        if (comm_get(comm_arena, "do", &command) == NOT_FOUND ||
+            command.value == NULL)
+        {
+            /* The end frame of the ring ends the commands; with
+             * acknowledgements, so does the end of stdin */
+            if ((GD.use_ack || GD.use_ring) && end_of_commands(&GD) &&
+                comm_is_empty(comm_arena))
+                break;
 
-        STR_IF_EQ(command.value, "add-attachment")
-        ret = att_set_add_by_command(&GD.A, comm_arena, 0);
+            if (GD.use_ack)
+            {
+                strncpy(
+                    error_message,
+                    "No `do` command provided.",
+                    MAX_ERROR_SIZE
+                );
+                ret = ack_command(&GD, id_c.value, FATAL_LOGIC);
+                assert(ret == OK, ret, "could not acknowledge command");
+                continue;
+            }
 
-        STR_IF_EQ(command.value, "set-body")
-        ret = att_set_add_by_command(&GD.A, comm_arena, 1);
+            assert(0, FATAL_LOGIC, "No `do` command provided.");
+            continue;
+        }
 
-        STR_IF_EQ(command.value, "print-clear-eml")
-        ret = print_clear_eml_by_command(&GD, comm_arena);
+        verb = verb_lookup(command.value);
 
-        STR_IF_EQ(command.value, "print-signed-eml")
-        ret = print_signed_eml_by_command(&GD, comm_arena);
+        if (verb == VERB_QUIT)
+        {
+            if (GD.use_ack)
+            {
+                ret = ack_command(&GD, id_c.value, OK);
+                assert(ret == OK, ret, "could not acknowledge command");
+            }
 
-        STR_IF_EQ(command.value, "clear")
-        global_data_init(&GD);
+            break;
+        }
 
-        STR_ELSE()
+        if (verb < 0)
         {
             ret = FATAL_LOGIC;
             strnappendv(
@@ -102,16 +323,384 @@ int main(int argc, char** argv)
                 MAX_ERROR_SIZE,
                 "`",
                 command.value,
-                "` not implemented, yet"
+                "` not implemented, yet",
+                NULL
             );
         }
+        else
+            ret = VERBS[verb].exec(&GD, comm_arena);
+
+        if (GD.use_ack)
+        {
+            ret = ack_command(&GD, id_c.value, ret);
+            assert(ret == OK, ret, "could not acknowledge command");
+            continue;
+        }
 
         assert(ret == OK, ret, error_message);
-    } while (file_last_rb(&GD.stdin_f) > 0);
+    } while (!end_of_commands(&GD));
+
+    /* The parser thread stops at the last command, which is the one seen */
+    if (GD.pipelined)
+    {
+        pthread_join(GD.parser, NULL);
+        cqueue_free(&GD.Q);
+    }
+
+    comm_arena_free(&arena);
+    eml_header_set_free(&GD.S);
+    att_set_free(&GD.A);
+
+    if (GD.use_ring)
+        ring_detach(&GD.ring);
+
+    return ret;
+}
+
+static int parse_args(
+    global_data_p GD, int argc, char** argv, char** shm, size_t* depth
+)
+{
+    int    i;
+    size_t fd;
+    size_t threads;
+
+    GD->use_ack = 0;
+
+    for (i = 1; i < argc; i += 2)
+    {
+        if (i + 1 >= argc)
+            return FATAL_PARAM;
+
+        if (strcmp(argv[i], "--shm") == 0 && *shm == NULL)
+            *shm = argv[i + 1];
+        else if (strcmp(argv[i], "--ack") == 0 && !GD->use_ack)
+        {
+            if (strtosize(argv[i + 1], &fd) != OK || fd > 65535 ||
+                fcntl((int)fd, F_GETFD) == -1)
+                return FATAL_PARAM;
+
+            file_set_fd(&GD->ack_f, (int)fd);
+            GD->use_ack = 1;
+        }
+        else if (strcmp(argv[i], "--threads") == 0)
+        {
+            if (strtosize(argv[i + 1], &threads) != OK || threads == 0 ||
+                threads > MAX_THREADS)
+                return FATAL_PARAM;
+
+            base64_set_threads((unsigned int)threads);
+            att_set_threads((unsigned int)threads);
+        }
+        else if (strcmp(argv[i], "--io") == 0)
+        {
+            /* Without io_uring, files are still read by read(2) */
+            if (strcmp(argv[i + 1], "uring") == 0)
+                uring_enable();
+            else if (strcmp(argv[i + 1], "sync") != 0)
+                return FATAL_PARAM;
+        }
+        else if (strcmp(argv[i], "--pipeline") == 0 && *depth == 0)
+        {
+            if (strtosize(argv[i + 1], depth) != OK || *depth == 0 ||
+                *depth > CQUEUE_MAX_SIZE)
+                return FATAL_PARAM;
+        }
+        else
+            return FATAL_PARAM;
+    }
+
+    return OK;
+}
+
+static int
+next_command(global_data_p GD, comm_arena_p comm_arena, int* in_sync)
+{
+    int         ret;
+    int         res;
+    const char* cmd;
+    size_t      sz;
+
+    *in_sync = 0;
+
+    if (GD->use_ring)
+    {
+        ret = ring_next(&GD->ring, &cmd, &sz);
+        return_iferr(ret);
+
+        /* The command is copied into the arena: the frame can be released */
+        ret = comm_parse_bin(cmd, sz, comm_arena);
+        ring_release(&GD->ring);
+
+        *in_sync = 1;
+        return ret;
+    }
+
+    /* A malformed binary command cannot be told apart from the next one */
+    if (GD->comm_mode == COMM_MODE_BIN)
+        return comm_next_bin(&GD->stdin_b, comm_arena);
+
+    ret = comm_next(&GD->stdin_b, comm_arena);
+
+    if (ret == ILLEGAL_FORMAT && GD->use_ack)
+    {
+        res = comm_skip_line(&GD->stdin_b, comm_arena);
+        return_iferr(res);
+
+        *in_sync = 1;
+    }
 
     return ret;
 }
 
+static int ack_command(global_data_p GD, const char* id, int code)
+{
+    int  ret;
+    char code_s[16];
+
+    if (id != NULL)
+    {
+        ret = file_write_str(&GD->ack_f, "id=\"");
+        return_iferr(ret);
+
+        ret = ack_write_quoted(&GD->ack_f, id);
+        return_iferr(ret);
+
+        ret = file_write_str(&GD->ack_f, "\" ");
+        return_iferr(ret);
+    }
+
+    if (code == OK)
+        return file_write_str(&GD->ack_f, "status=ok\n");
+
+    sprintf(code_s, "%d", code);
+
+    ret = file_write_strv(
+        &GD->ack_f,
+        "status=error code=",
+        code_s,
+        " message=\"",
+        NULL
+    );
+    return_iferr(ret);
+
+    if (code > ERRNO_SPLIT)
+    {
+        ret = ack_write_quoted(&GD->ack_f, strerror(code - ERRNO_SPLIT));
+        return_iferr(ret);
+
+        ret = file_write_str(&GD->ack_f, "; ");
+        return_iferr(ret);
+    }
+
+    ret = ack_write_quoted(&GD->ack_f, error_message);
+    return_iferr(ret);
+
+    return file_write_str(&GD->ack_f, "\"\n");
+}
+
+static int ack_write_quoted(file_p F, const char* str)
+{
+    int         ret;
+    const char* run;
+    const char* esc;
+
+    for (run = str;; ++str)
+    {
+        switch (*str)
+        {
+        case '\0':
+            esc = NULL;
+            break;
+        case '"':
+            esc = "\\\"";
+            break;
+        case '\\':
+            esc = "\\\\";
+            break;
+        case '\n':
+            esc = "\\n";
+            break;
+        case '\r':
+            esc = "\\r";
+            break;
+        case '\t':
+            esc = "\\t";
+            break;
+        default:
+            continue;
+        }
+
+        if (str > run)
+        {
+            ret = file_write(F, run, (size_t)(str - run));
+            return_iferr(ret);
+        }
+
+        if (esc == NULL)
+            return OK;
+
+        ret = file_write_str(F, esc);
+        return_iferr(ret);
+
+        run = str + 1;
+    }
+}
+
+static int fetch_command(
+    global_data_p GD, comm_arena_p own, comm_arena_p* comm_arena, int* in_sync
+)
+{
+    if (!GD->pipelined)
+    {
+        *comm_arena = own;
+        return next_command(GD, own, in_sync);
+    }
+
+    if (GD->slot != NULL)
+        cqueue_pop(&GD->Q);
+
+    GD->slot    = cqueue_front(&GD->Q);
+    *comm_arena = &GD->slot->A;
+    *in_sync    = GD->slot->in_sync;
+
+    if (GD->slot->res != OK)
+        memcpy(error_message, GD->slot->message, MAX_ERROR_SIZE);
+
+    return GD->slot->res;
+}
+
+static void* parse_ahead(void* arg)
+{
+    global_data_p GD = arg;
+    cqueue_slot_p slot;
+    int           last;
+
+    do
+    {
+        slot = cqueue_reserve(&GD->Q);
+        parse_slot(GD, slot);
+
+        /* Once pushed, the slot belongs to the executor */
+        last = slot->last;
+        cqueue_push(&GD->Q);
+    } while (!last);
+
+    return NULL;
+}
+
+static void parse_slot(global_data_p GD, cqueue_slot_p slot)
+{
+    struct comm_t c;
+    size_t        sz;
+    int           verb = -1;
+    int           ret;
+
+    slot->block      = NULL;
+    slot->block_size = 0;
+    slot->block_res  = OK;
+
+    slot->res        = next_command(GD, &slot->A, &slot->in_sync);
+    if (slot->res != OK)
+    {
+        memcpy(slot->message, error_message, MAX_ERROR_SIZE);
+        slot->last = !slot->in_sync || end_of_stream(GD);
+        return;
+    }
+
+    if (comm_get(&slot->A, "do", &c) == OK && c.value != NULL)
+        verb = verb_lookup(c.value);
+
+    /* Nothing is read after `quit` */
+    if (verb == VERB_QUIT)
+    {
+        slot->last = 1;
+        return;
+    }
+
+    /* Same condition as add_part_by_command, which reads the block anyway */
+    ret = OK;
+    if ((verb == VERB_ADD_ATTACHMENT || verb == VERB_SET_BODY) &&
+        comm_get(&slot->A, "inline-size", &c) == OK &&
+        strtosize(c.value, &sz) == OK)
+    {
+        slot->block_size = sz;
+        if (sz > 0)
+            slot->block = malloc(sz);
+
+        if (sz > 0 && slot->block == NULL)
+        {
+            slot->block_res = ERRNO_SPLIT + errno;
+            strncpy(
+                slot->message,
+                "could not allocate inline block",
+                MAX_ERROR_SIZE
+            );
+
+            ret = comm_read_block(&GD->stdin_b, &slot->A, NULL, sz);
+        }
+        else
+        {
+            ret = comm_read_block(&GD->stdin_b, &slot->A, slot->block, sz);
+            slot->block_res = ret;
+            if (ret != OK)
+                memcpy(slot->message, error_message, MAX_ERROR_SIZE);
+        }
+    }
+
+    slot->last = ret != OK || end_of_stream(GD);
+}
+
+static int end_of_commands(global_data_p GD)
+{
+    if (GD->pipelined)
+        return GD->slot->last;
+
+    return end_of_stream(GD);
+}
+
+static int end_of_stream(global_data_p GD)
+{
+    if (GD->use_ring)
+        return GD->ring.done;
+
+    return file_last_rb(&GD->stdin_f) <= 0;
+}
+
+static int verb_lookup(const char* name)
+{
+    int verb;
+
+    switch (strlen(name))
+    {
+    case 4:
+        verb = VERB_QUIT;
+        break;
+    case 5:
+        verb = VERB_CLEAR;
+        break;
+    case 8:
+        verb = VERB_SET_BODY;
+        break;
+    case 10:
+        verb = VERB_ADD_HEADER;
+        break;
+    case 14:
+        verb = VERB_ADD_ATTACHMENT;
+        break;
+    case 15:
+        verb = VERB_PRINT_CLEAR_EML;
+        break;
+    case 16:
+        verb = VERB_PRINT_SIGNED_EML;
+        break;
+    default:
+        return -1;
+    }
+
+    return strcmp(VERBS[verb].name, name) == 0 ? verb : -1;
+}
+
 static int print_eml_a(
     eml_header_set_p S, att_set_p A, file_p out, const char* mainbody, int sign
 )
@@ -119,11 +708,14 @@ static int print_eml_a(
     int res = OK;
 
     /* Boundary */
-    char raw_boundary[53]; /* Including trailing NUL */
+    char raw_boundary[ATT_BOUNDARY_SIZE + 1]; /* Including trailing NUL */
     char boundary_header[256];
 
-    get_rand_string(raw_boundary, sizeof(raw_boundary) - sizeof(char));
-    raw_boundary[52] = '\0';
+    res = att_set_prepare(A);
+    return_iferr(res);
+
+    res = att_set_boundary(A, raw_boundary);
+    return_iferr(res);
 
     if (sign)
         strnappendv(
@@ -165,49 +757,284 @@ static int print_eml_a(
     return res;
 }
 
-static void global_data_init(global_data_p GD)
+static int output_open(output_p O, comm_arena_p comm_arena, file_p* print)
+{
+    struct comm_t path_c;
+    struct comm_t fd_c;
+    struct comm_t frame_c;
+    size_t        fd;
+    int           ret;
+
+    O->owned  = 0;
+    O->framed = 0;
+
+    if (comm_get(comm_arena, "frame", &frame_c) == OK)
+    {
+        if (frame_c.value == NULL || strcmp(frame_c.value, "length") != 0)
+        {
+            strncpy(error_message, "invalid frame", MAX_ERROR_SIZE);
+            return ILLEGAL_FORMAT;
+        }
+
+        O->framed = 1;
+    }
+
+    if (comm_get(comm_arena, "fd", &fd_c) == OK)
+    {
+        if (strtosize(fd_c.value, &fd) != OK || fd > 65535 ||
+            fcntl((int)fd, F_GETFD) == -1)
+        {
+            strncpy(error_message, "invalid fd", MAX_ERROR_SIZE);
+            return ILLEGAL_FORMAT;
+        }
+
+        file_set_fd(&O->F, (int)fd);
+    }
+    else if (comm_get(comm_arena, "path", &path_c) == NOT_FOUND ||
+             path_c.value == NULL)
+    {
+        strncpy(error_message, "no path provided", MAX_ERROR_SIZE);
+        return ILLEGAL_FORMAT;
+    }
+    else if (strcmp(path_c.value, "-") == 0)
+        file_set_fd(&O->F, STDOUT_FILENO);
+    else if (O->framed)
+    {
+        strncpy(error_message, "frame needs path=- or fd", MAX_ERROR_SIZE);
+        return ILLEGAL_FORMAT;
+    }
+    else
+    {
+        ret = file_open(&O->F, path_c.value, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (ret != OK)
+        {
+            strnappendv(
+                error_message, MAX_ERROR_SIZE, "open; ", path_c.value, NULL
+            );
+            return ret;
+        }
+
+        O->owned = 1;
+    }
+
+    *print = &O->F;
+
+    if (O->framed)
+    {
+        ret = file_open_mem(&O->spool);
+        if (ret != OK)
+        {
+            strncpy(error_message, "could not open spool", MAX_ERROR_SIZE);
+            return ret;
+        }
+
+        *print = &O->spool;
+    }
+
+    return OK;
+}
+
+static int output_close(output_p O, int res)
 {
-    file_set_fd(&GD->stdin_f, STDIN_FILENO);
+    off_t         size;
+    unsigned char prefix[4];
+
+    if (O->framed)
+    {
+        size = file_cur(&O->spool);
+
+        if (res == OK && (size < 0 || size > 0xFFFFFFFFL))
+        {
+            strncpy(error_message, "message too big to frame", MAX_ERROR_SIZE);
+            res = STRING_TOO_LONG;
+        }
+
+        /* Nothing is sent for a message that failed */
+        if (res == OK)
+        {
+            prefix[0] = (unsigned char)(size >> 24 & 0xFF);
+            prefix[1] = (unsigned char)(size >> 16 & 0xFF);
+            prefix[2] = (unsigned char)(size >> 8 & 0xFF);
+            prefix[3] = (unsigned char)(size & 0xFF);
 
+            res = file_write(&O->F, (const char*)prefix, sizeof(prefix));
+        }
+
+        if (res == OK)
+            res = file_copy(&O->F, &O->spool);
+
+        file_close(&O->spool);
+    }
+
+    if (O->owned)
+        file_close(&O->F);
+
+    return res;
+}
+
+static void global_data_init(global_data_p GD)
+{
     eml_header_set_init(&GD->S);
     att_set_init(&GD->A);
 }
 
-static int print_clear_eml_by_command(global_data_p GD, int* comm_arena)
+static int add_header_by_command(global_data_p GD, comm_arena_p comm_arena)
 {
-    int                     ret;
-    struct comm_t           path_c;
-    struct eml_header_set_t Scopy;
-    struct file_t           out;
+    return eml_header_set_add_by_command(&GD->S, comm_arena);
+}
 
-    if (comm_get(comm_arena, "path", &path_c) == NOT_FOUND ||
-        path_c.value == NULL)
+static int add_attachment_by_command(global_data_p GD, comm_arena_p comm_arena)
+{
+    return add_part_by_command(GD, comm_arena, 0);
+}
+
+static int set_body_by_command(global_data_p GD, comm_arena_p comm_arena)
+{
+    return add_part_by_command(GD, comm_arena, 1);
+}
+
+static int
+add_part_by_command(global_data_p GD, comm_arena_p comm_arena, int is_body)
+{
+    int           ret;
+    att_p         att;
+    struct comm_t size_c;
+    size_t        sz;
+    char*         block      = NULL;
+    size_t        block_size = 0;
+
+    /* A block read ahead is handed over rather than copied */
+    if (GD->pipelined && GD->slot->block_res == OK)
     {
-        ret = ILLEGAL_FORMAT;
-        strncpy(error_message, "no path provided", MAX_ERROR_SIZE);
+        block      = GD->slot->block;
+        block_size = GD->slot->block_size;
+    }
+
+    ret = att_set_add_by_command(
+        &GD->A, comm_arena, is_body, block, block_size
+    );
+
+    /* Skip the inline block anyway, so that the next command can be read */
+    if (ret != OK)
+    {
+        if (comm_get(comm_arena, "inline-size", &size_c) == OK &&
+            strtosize(size_c.value, &sz) == OK)
+            (void)read_block(GD, comm_arena, NULL, sz);
+
         return ret;
     }
 
-    ret = file_open(&out, path_c.value, O_RDWR | O_CREAT | O_TRUNC, 0644);
-    return_iferr(ret);
+    att = GD->A.attachments + GD->A.count - 1;
+    if (att->data == NULL)
+        return OK;
 
-    eml_header_set_copy(&Scopy, &GD->S);
+    if (block != NULL && att->data == block)
+    {
+        GD->slot->block = NULL;
+        return OK;
+    }
+
+    return read_block(GD, comm_arena, att->data, att->data_size);
+}
+
+static int
+read_block(global_data_p GD, comm_arena_p comm_arena, char* dst, size_t sz)
+{
+    int         ret;
+    const char* block;
+    size_t      block_sz;
+
+    if (GD->pipelined)
+    {
+        if (GD->slot->block_res != OK)
+        {
+            memcpy(error_message, GD->slot->message, MAX_ERROR_SIZE);
+            return GD->slot->block_res;
+        }
 
-    ret = print_eml_a(&Scopy, &GD->A, &out, MAIN_BODY_CLEAR, 0);
+        if (GD->slot->block_size != sz)
+        {
+            strncpy(
+                error_message,
+                "Inline block size mismatch",
+                MAX_ERROR_SIZE
+            );
+            return ILLEGAL_FORMAT;
+        }
+
+        if (dst != NULL && sz > 0)
+            memcpy(dst, GD->slot->block, sz);
 
-    file_close(&out);
+        return OK;
+    }
+
+    if (!GD->use_ring)
+        return comm_read_block(&GD->stdin_b, comm_arena, dst, sz);
+
+    /* Empty blocks take no frame */
+    if (sz == 0)
+        return OK;
+
+    ret = ring_next(&GD->ring, &block, &block_sz);
+    return_iferr(ret);
+
+    if (block_sz == sz)
+    {
+        if (dst != NULL)
+            memcpy(dst, block, sz);
+    }
+    else
+    {
+        strncpy(error_message, "Inline block size mismatch", MAX_ERROR_SIZE);
+        ret = ILLEGAL_FORMAT;
+    }
+
+    ring_release(&GD->ring);
 
     return ret;
 }
 
-static int print_signed_eml_by_command(global_data_p GD, int* comm_arena)
+static int clear_by_command(global_data_p GD, comm_arena_p comm_arena)
+{
+    (void)comm_arena;
+
+    eml_header_set_free(&GD->S);
+    att_set_free(&GD->A);
+    global_data_init(GD);
+    return OK;
+}
+
+static int
+print_clear_eml_by_command(global_data_p GD, comm_arena_p comm_arena)
+{
+    int                     ret;
+    struct eml_header_set_t Scopy;
+    struct output_t         out;
+    file_p                  print;
+
+    ret = output_open(&out, comm_arena, &print);
+    return_iferr(ret);
+
+    ret = eml_header_set_copy(&Scopy, &GD->S);
+
+    if (ret == OK)
+    {
+        ret = print_eml_a(&Scopy, &GD->A, print, MAIN_BODY_CLEAR, 0);
+        eml_header_set_free(&Scopy);
+    }
+
+    return output_close(&out, ret);
+}
+
+static int
+print_signed_eml_by_command(global_data_p GD, comm_arena_p comm_arena)
 {
     int                     ret;
-    struct comm_t           path_c;
     struct comm_t           clear_path_c;
     struct comm_t           sign_path_c;
     struct eml_header_set_t Scopy;
-    struct file_t           out;
+    struct output_t         out;
+    file_p                  print;
 
     if (comm_get(comm_arena, "clear-message", &clear_path_c) == NOT_FOUND ||
         clear_path_c.value == NULL)
@@ -225,34 +1052,28 @@ static int print_signed_eml_by_command(global_data_p GD, int* comm_arena)
         return ret;
     }
 
-    if (comm_get(comm_arena, "path", &path_c) == NOT_FOUND ||
-        path_c.value == NULL)
-    {
-        ret = ILLEGAL_FORMAT;
-        strncpy(error_message, "no path provided", MAX_ERROR_SIZE);
-        return ret;
-    }
-
-    ret = att_set_add(&GD->A, ATT_NOMIME, "", clear_path_c.value, ATT_FMT_7BIT);
+    ret = output_open(&out, comm_arena, &print);
     return_iferr(ret);
 
-    ret = att_set_add(
-        &GD->A,
-        "application/pgp-signature",
-        ATT_SIGNATURE_FILENAME,
-        sign_path_c.value,
-        ATT_FMT_7BIT
-    );
-    return_iferr(ret);
-
-    ret = file_open(&out, path_c.value, O_RDWR | O_CREAT | O_TRUNC, 0644);
-    return_iferr(ret);
+    ret = att_set_add(&GD->A, ATT_NOMIME, "", clear_path_c.value, ATT_FMT_7BIT);
 
-    eml_header_set_copy(&Scopy, &GD->S);
+    if (ret == OK)
+        ret = att_set_add(
+            &GD->A,
+            "application/pgp-signature",
+            ATT_SIGNATURE_FILENAME,
+            sign_path_c.value,
+            ATT_FMT_7BIT
+        );
 
-    ret = print_eml_a(&Scopy, &GD->A, &out, MAIN_BODY_SIGN, 1);
+    if (ret == OK)
+        ret = eml_header_set_copy(&Scopy, &GD->S);
 
-    file_close(&out);
+    if (ret == OK)
+    {
+        ret = print_eml_a(&Scopy, &GD->A, print, MAIN_BODY_SIGN, 1);
+        eml_header_set_free(&Scopy);
+    }
 
-    return ret;
+    return output_close(&out, ret);
 }
@@ -0,0 +1,407 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#include "feat.h"
+
+#include "error.h"
+#include "qp.h"
+#include "util.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QP_X86
+#include <immintrin.h>
+#endif
+
+/* Input bytes read per step by the file encoder */
+#define QP_CHUNK 49152
+
+typedef struct qp_out_t
+{
+    struct wbuffer_t W;
+    int              col;     /* Chars in the current line */
+    int              pending; /* Space or tab held back, or 0 */
+    int              cr;      /* A <CR> held back: <LF> may follow */
+}* qp_out_p;
+
+static const char HEX[] = "0123456789ABCDEF";
+
+/*
+ * Bytes that are copied as they are, in runs: printable ASCII but '=', space
+ * and tab. Spaces and tabs are only unsafe at the end of a line, thus a run
+ * never ends by one of them: the last is held back (`pending`) until the next
+ * byte tells whether it shall be escaped.
+ */
+
+/** Return the number of leading bytes of `src` that may be copied as such */
+static size_t qp_scan_scalar(const unsigned char* src, size_t n);
+
+#ifdef QP_X86
+static size_t qp_scan_sse2(const unsigned char* src, size_t n);
+static size_t qp_scan_avx2(const unsigned char* src, size_t n);
+#endif
+
+/** Set by qp_init to the fastest scanner the CPU supports */
+static size_t (*qp_scan)(const unsigned char* src, size_t n) = qp_scan_scalar;
+
+/* Writers return OK, or ERRNO_SPLIT + errno on write error */
+
+static void qp_out_init(qp_out_p O, file_p out);
+static int  qp_out_body(qp_out_p O, const unsigned char* src, size_t n);
+static int  qp_out_last(qp_out_p O);
+
+/** Write `n` chars that shall not be split, after a soft break if needed */
+static int qp_put(qp_out_p O, const char* s, int n);
+static int qp_put_hex(qp_out_p O, unsigned char c);
+
+/** Write a run of safe bytes, split by soft breaks */
+static int qp_put_run(qp_out_p O, const unsigned char* src, size_t n);
+
+/** Write the held back space or tab, if any, escaped or not */
+static int qp_put_pending(qp_out_p O, int escape);
+
+static int qp_soft_break(qp_out_p O);
+static int qp_hard_break(qp_out_p O);
+
+void qp_init(void)
+{
+#ifdef QP_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        qp_scan = qp_scan_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        qp_scan = qp_scan_sse2;
+#endif
+}
+
+static size_t qp_scan_scalar(const unsigned char* src, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        if ((src[i] < ' ' || src[i] > '~' || src[i] == '=') && src[i] != '\t')
+            break;
+
+    return i;
+}
+
+#ifdef QP_X86
+/* Bytes are compared as signed: those above 127 are negative, thus below ' ' */
+
+__attribute__((target("sse2"))) static size_t
+qp_scan_sse2(const unsigned char* src, size_t n)
+{
+    __m128i      v;
+    __m128i      ok;
+    unsigned int bad;
+    size_t       i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        v  = _mm_loadu_si128((const __m128i*)(const void*)(src + i));
+        ok = _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8(' ' - 1)),
+            _mm_cmplt_epi8(v, _mm_set1_epi8('~' + 1))
+        );
+        ok = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('=')), ok);
+        ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+
+        bad = (unsigned int)_mm_movemask_epi8(ok) ^ 0xFFFFu;
+        if (bad != 0)
+            return i + (size_t)__builtin_ctz(bad);
+    }
+
+    return i + qp_scan_scalar(src + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+qp_scan_avx2(const unsigned char* src, size_t n)
+{
+    __m256i      v;
+    __m256i      ok;
+    unsigned int bad;
+    size_t       i;
+
+    for (i = 0; i + 32 <= n; i += 32)
+    {
+        v  = _mm256_loadu_si256((const __m256i*)(const void*)(src + i));
+        ok = _mm256_and_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(' ' - 1)),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8('~' + 1), v)
+        );
+        ok = _mm256_andnot_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('=')), ok
+        );
+        ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+
+        bad = ~(unsigned int)_mm256_movemask_epi8(ok);
+        if (bad != 0)
+            return i + (size_t)__builtin_ctz(bad);
+    }
+
+    return i + qp_scan_sse2(src + i, n - i);
+}
+#endif
+
+static void qp_out_init(qp_out_p O, file_p out)
+{
+    wbuffer_init(&O->W, out);
+    O->col     = 0;
+    O->pending = 0;
+    O->cr      = 0;
+}
+
+static int qp_out_body(qp_out_p O, const unsigned char* src, size_t n)
+{
+    size_t i   = 0;
+    int    res = OK;
+    size_t run;
+
+    while (res == OK && i < n)
+    {
+        if (O->cr)
+        {
+            O->cr = 0;
+
+            if (src[i] == '\n')
+            {
+                res = qp_hard_break(O);
+                ++i;
+                continue;
+            }
+
+            res = qp_put_pending(O, 0);
+            if (res == OK)
+                res = qp_put_hex(O, '\r');
+            return_iferr(res);
+        }
+
+        run = qp_scan(src + i, n - i);
+        if (run > 0 && (src[i + run - 1] == ' ' || src[i + run - 1] == '\t'))
+            --run;
+
+        if (run > 0)
+        {
+            res = qp_put_pending(O, 0);
+            if (res == OK)
+                res = qp_put_run(O, src + i, run);
+            i += run;
+            continue;
+        }
+
+        switch (src[i])
+        {
+        case ' ':
+        case '\t':
+            res        = qp_put_pending(O, 0);
+            O->pending = src[i];
+            break;
+        case '\r':
+            O->cr = 1;
+            break;
+        case '\n':
+            res = qp_hard_break(O);
+            break;
+        default:
+            res = qp_put_pending(O, 0);
+            if (res == OK)
+                res = qp_put_hex(O, src[i]);
+            break;
+        }
+
+        ++i;
+    }
+
+    return res;
+}
+
+static int qp_out_last(qp_out_p O)
+{
+    int res;
+
+    if (O->cr)
+    {
+        res = qp_put_pending(O, 0);
+        if (res == OK)
+            res = qp_put_hex(O, '\r');
+        return_iferr(res);
+        O->cr = 0;
+    }
+
+    /* The line ends here: the caller follows with <CR><LF> */
+    res = qp_put_pending(O, 1);
+    return_iferr(res);
+
+    return wbuffer_flush(&O->W);
+}
+
+static int qp_put(qp_out_p O, const char* s, int n)
+{
+    char* dst;
+    int   res;
+
+    /* One column is left for the '=' of a soft break */
+    if (O->col + n > QP_LINE_LENGTH - 1)
+    {
+        res = qp_soft_break(O);
+        return_iferr(res);
+    }
+
+    res = wbuffer_room(&O->W, (size_t)n, &dst);
+    return_iferr(res);
+
+    memcpy(dst, s, (size_t)n);
+    O->W.cur += (size_t)n;
+    O->col += n;
+
+    return OK;
+}
+
+static int qp_put_hex(qp_out_p O, unsigned char c)
+{
+    char esc[3];
+
+    esc[0] = '=';
+    esc[1] = HEX[c >> 4];
+    esc[2] = HEX[c & 0xF];
+
+    return qp_put(O, esc, 3);
+}
+
+static int qp_put_run(qp_out_p O, const unsigned char* src, size_t n)
+{
+    size_t fit;
+    char*  dst;
+    int    res;
+
+    while (n > 0)
+    {
+        if (O->col >= QP_LINE_LENGTH - 1)
+        {
+            res = qp_soft_break(O);
+            return_iferr(res);
+        }
+
+        fit = (size_t)(QP_LINE_LENGTH - 1 - O->col);
+        if (fit > n)
+            fit = n;
+
+        res = wbuffer_room(&O->W, fit, &dst);
+        return_iferr(res);
+
+        memcpy(dst, src, fit);
+        O->W.cur += fit;
+        O->col += (int)fit;
+
+        src += fit;
+        n -= fit;
+    }
+
+    return OK;
+}
+
+static int qp_put_pending(qp_out_p O, int escape)
+{
+    char c;
+    int  res;
+
+    if (O->pending == 0)
+        return OK;
+
+    if (escape)
+        res = qp_put_hex(O, (unsigned char)O->pending);
+    else
+    {
+        c   = (char)O->pending;
+        res = qp_put(O, &c, 1);
+    }
+
+    O->pending = 0;
+
+    return res;
+}
+
+static int qp_soft_break(qp_out_p O)
+{
+    char* dst;
+    int   res;
+
+    res = wbuffer_room(&O->W, 3, &dst);
+    return_iferr(res);
+
+    memcpy(dst, "=\r\n", 3);
+    O->W.cur += 3;
+    O->col = 0;
+
+    return OK;
+}
+
+static int qp_hard_break(qp_out_p O)
+{
+    char* dst;
+    int   res;
+
+    /* A space or tab before a line break would be lost in transport */
+    res = qp_put_pending(O, 1);
+    if (res == OK)
+        res = wbuffer_room(&O->W, 2, &dst);
+    return_iferr(res);
+
+    memcpy(dst, "\r\n", 2);
+    O->W.cur += 2;
+    O->col = 0;
+
+    return OK;
+}
+
+int qp_file_to_file(file_p in, file_p out)
+{
+    unsigned char src[QP_CHUNK];
+    ssize_t       rb  = 0;
+    int           res = OK;
+
+    struct qp_out_t file_out;
+
+    qp_out_init(&file_out, out);
+
+    if (file_isreg(in))
+    {
+        res = file_seek(in, 0, SEEK_SET);
+        if (res != OK)
+        {
+            strncpy(error_message, "qp_file_to_file: seek set", MAX_ERROR_SIZE);
+            return res;
+        }
+    }
+
+    while (res == OK && (rb = file_read(in, (char*)src, sizeof(src))) > 0)
+        res = qp_out_body(&file_out, src, (size_t)rb);
+
+    if (res == OK && rb < 0)
+    {
+        strncpy(error_message, "qp_file_to_file: read", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + errno;
+    }
+
+    if (res == OK)
+        res = qp_out_last(&file_out);
+
+    return res;
+}
+
+int qp_buf_to_file(const char* in, size_t sz, file_p out)
+{
+    int res;
+
+    struct qp_out_t file_out;
+
+    qp_out_init(&file_out, out);
+
+    res = qp_out_body(&file_out, (const unsigned char*)in, sz);
+    if (res == OK)
+        res = qp_out_last(&file_out);
+
+    return res;
+}
@@ -0,0 +1,38 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#ifndef CMC_EML_QP_H_INCLUDED
+#define CMC_EML_QP_H_INCLUDED
+
+#include "io.h"
+
+/* RFC 2045: encoded lines, soft line break included */
+#define QP_LINE_LENGTH 76
+
+/**
+ * Select the fastest scanner the CPU supports (AVX2 or SSE2 on x86, scalar
+ * otherwise); the output is the same in any case.
+ *
+ * It must be called once, at startup, before any encoding.
+ */
+extern void qp_init(void);
+
+/**
+ * Encode `in`, from its beginning if it is a regular file, into `out` as
+ * quoted-printable text (RFC 2045).
+ *
+ * The input is text: line breaks, either <LF> or <CR><LF>, become <CR><LF>,
+ * while a bare <CR> is escaped. Longer lines are split by soft line breaks, so
+ * that no line is longer than QP_LINE_LENGTH chars; the last line is not
+ * followed by <CR><LF> unless the input ends by a line break.
+ *
+ * Return:
+ * - OK;
+ * - ERRNO_SPLIT + errno, on read or write error.
+ */
+extern int qp_file_to_file(file_p in, file_p out);
+
+/** Same as qp_file_to_file, but the input is the `sz` bytes at `in` */
+extern int qp_buf_to_file(const char* in, size_t sz, file_p out);
+
+#endif /* CMC_EML_QP_H_INCLUDED */
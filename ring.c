@@ -0,0 +1,214 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#include "feat.h"
+
+#include "error.h"
+#include "ring.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef __linux__
+/** Wait until `*word` is no more equal to `val` */
+static int ring_wait(unsigned int* word, unsigned int val);
+
+/** Wake all the waiters on `word` */
+static void ring_wake(unsigned int* word);
+
+/** Read a 4 bytes, unsigned, big endian integer */
+static unsigned long ring_u32(const char* buf);
+
+int ring_attach(ring_p R, const char* name)
+{
+    int         fd;
+    struct stat s;
+    void*       map;
+    size_t      size;
+
+    R->H          = NULL;
+    R->data       = NULL;
+    R->map_size   = 0;
+    R->frame_size = 0;
+    R->done       = 0;
+
+    fd            = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+    {
+        strncpy(error_message, "ring_attach: shm_open", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + errno;
+    }
+
+    if (fstat(fd, &s) != 0)
+    {
+        strncpy(error_message, "ring_attach: fstat", MAX_ERROR_SIZE);
+        close(fd);
+        return ERRNO_SPLIT + errno;
+    }
+
+    if (s.st_size < RING_HEADER_SIZE)
+    {
+        strncpy(error_message, "ring_attach: no ring header", MAX_ERROR_SIZE);
+        close(fd);
+        return ILLEGAL_FORMAT;
+    }
+
+    map = mmap(
+        NULL, (size_t)s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0
+    );
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        strncpy(error_message, "ring_attach: mmap", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + errno;
+    }
+
+    R->H        = (ring_header_p)map;
+    R->data     = (char*)map + RING_HEADER_SIZE;
+    R->map_size = (size_t)s.st_size;
+
+    size        = R->H->size;
+    if (memcmp(R->H->magic, RING_MAGIC, RING_MAGIC_SIZE) != 0 || size < 4 ||
+        (size & (size - 1)) != 0 ||
+        size > R->map_size - RING_HEADER_SIZE)
+    {
+        strncpy(error_message, "ring_attach: invalid ring", MAX_ERROR_SIZE);
+        ring_detach(R);
+        return ILLEGAL_FORMAT;
+    }
+
+    return OK;
+}
+
+int ring_next(ring_p R, const char** cmd, size_t* sz)
+{
+    unsigned int  head;
+    unsigned int  tail;
+    unsigned int  pos;
+    unsigned int  size = R->H->size;
+    unsigned long len;
+    int           res;
+
+    for (;;)
+    {
+        tail = R->H->tail;
+        head = __atomic_load_n(&R->H->head, __ATOMIC_ACQUIRE);
+
+        if (head == tail)
+        {
+            res = ring_wait(&R->H->head, head);
+            return_iferr(res);
+            continue;
+        }
+
+        pos = tail & (size - 1);
+
+        if (head - tail < 4)
+            break;
+
+        len = ring_u32(R->data + pos);
+
+        if (len == RING_FRAME_WRAP)
+        {
+            __atomic_store_n(
+                &R->H->tail, tail + (size - pos), __ATOMIC_RELEASE
+            );
+            ring_wake(&R->H->tail);
+            continue;
+        }
+
+        if (len > size - pos - 4 || len > head - tail - 4)
+            break;
+
+        *cmd          = R->data + pos + 4;
+        *sz           = len;
+        R->frame_size = (unsigned int)(4 + len + 3) & ~3U;
+        R->done       = len == 0;
+
+        return OK;
+    }
+
+    strncpy(error_message, "ring_next: invalid frame", MAX_ERROR_SIZE);
+    return ILLEGAL_FORMAT;
+}
+
+void ring_release(ring_p R)
+{
+    if (R->frame_size == 0)
+        return;
+
+    __atomic_store_n(
+        &R->H->tail, R->H->tail + R->frame_size, __ATOMIC_RELEASE
+    );
+    R->frame_size = 0;
+
+    ring_wake(&R->H->tail);
+}
+
+void ring_detach(ring_p R)
+{
+    if (R->H != NULL)
+        munmap(R->H, R->map_size);
+
+    R->H        = NULL;
+    R->data     = NULL;
+    R->map_size = 0;
+}
+
+static int ring_wait(unsigned int* word, unsigned int val)
+{
+    if (syscall(SYS_futex, word, FUTEX_WAIT, val, NULL, NULL, 0) == 0)
+        return OK;
+
+    /* Value already changed or interrupted: the caller checks again */
+    if (errno == EAGAIN || errno == EINTR)
+        return OK;
+
+    strncpy(error_message, "ring_wait: futex", MAX_ERROR_SIZE);
+    return ERRNO_SPLIT + errno;
+}
+
+static void ring_wake(unsigned int* word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, 0x7FFFFFFF, NULL, NULL, 0);
+}
+
+static unsigned long ring_u32(const char* buf)
+{
+    const unsigned char* u = (const unsigned char*)buf;
+
+    return ((unsigned long)u[0] << 24) | ((unsigned long)u[1] << 16) |
+           ((unsigned long)u[2] << 8) | (unsigned long)u[3];
+}
+#else
+int ring_attach(ring_p R, const char* name)
+{
+    (void)name;
+
+    R->H = NULL;
+    strncpy(error_message, "ring_attach: not supported", MAX_ERROR_SIZE);
+    return ERRNO_SPLIT + ENOSYS;
+}
+
+int ring_next(ring_p R, const char** cmd, size_t* sz)
+{
+    (void)R;
+    (void)cmd;
+    (void)sz;
+
+    return ERRNO_SPLIT + ENOSYS;
+}
+
+void ring_release(ring_p R) { (void)R; }
+
+void ring_detach(ring_p R) { R->H = NULL; }
+#endif
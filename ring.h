@@ -0,0 +1,91 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#ifndef CMC_EML_RING_H_INCLUDED
+#define CMC_EML_RING_H_INCLUDED
+
+#include "feat.h"
+
+#include <stddef.h>
+
+/*
+ * Shared memory job ring.
+ *
+ * A producer on the same host creates a POSIX shared memory object (shm_open)
+ * made up by a RING_HEADER_SIZE bytes header followed by `size` bytes of data,
+ * then cmc-eml attaches to it by name and consumes commands in place.
+ *
+ * Header (native byte order, 32 bits unsigned integers):
+ * - magic: RING_MAGIC_SIZE bytes, RING_MAGIC;
+ * - size: data size in bytes; a power of 2, at least 4;
+ * - head: bytes written so far by the producer, modulo 2^32;
+ * - tail: bytes consumed so far by cmc-eml, modulo 2^32.
+ *
+ * `head` is only written by the producer, `tail` only by cmc-eml; both are
+ * futex words: whoever moves one of them wakes the waiters on it (FUTEX_WAKE,
+ * not private). cmc-eml waits on `head` while the ring is empty; the producer
+ * is expected to wait on `tail` while the ring is full.
+ *
+ * Data is a sequence of frames, each starting at a 4 bytes aligned offset:
+ * - length: 4 bytes, unsigned, big endian;
+ * - length bytes: one command in the binary protocol (see comm_next_bin);
+ * - padding up to the next 4 bytes boundary.
+ *
+ * Frames never wrap: if a frame does not fit before the end of data, the
+ * producer writes RING_FRAME_WRAP as length and starts the frame at offset 0.
+ * A frame with length 0 ends the stream.
+ *
+ * example/ring/producer.py is a stand-in producer.
+ */
+
+#define RING_MAGIC "cmc-ring"
+#define RING_MAGIC_SIZE 8
+#define RING_HEADER_SIZE 64
+#define RING_FRAME_WRAP 0xFFFFFFFFUL
+
+typedef struct ring_header_t
+{
+    char         magic[RING_MAGIC_SIZE];
+    unsigned int size;
+    unsigned int head;
+    unsigned int tail;
+}* ring_header_p;
+
+typedef struct ring_t
+{
+    ring_header_p H;
+    char*         data;
+    size_t        map_size;
+    unsigned int  frame_size; /* Bytes to release after the current frame */
+    int           done;       /* The end frame has been consumed */
+}* ring_p;
+
+/**
+ * Attach to the shared memory ring `name` (as for shm_open).
+ *
+ * Return:
+ * - OK;
+ * - ILLEGAL_FORMAT, if the object is not a valid ring;
+ * - ERRNO_SPLIT + errno, on system error.
+ */
+extern int ring_attach(ring_p R, const char* name);
+
+/**
+ * Wait for the next frame and set `cmd` and `sz` to the command it holds. The
+ * command stays valid until ring_release is called.
+ *
+ * When the end frame is reached, `sz` is set to 0 and R->done to 1.
+ *
+ * Return:
+ * - OK;
+ * - ILLEGAL_FORMAT, if the frame is not valid;
+ * - ERRNO_SPLIT + errno, on system error.
+ */
+extern int ring_next(ring_p R, const char** cmd, size_t* sz);
+
+/** Hand the current frame back to the producer */
+extern void ring_release(ring_p R);
+
+extern void ring_detach(ring_p R);
+
+#endif /* CMC_EML_RING_H_INCLUDED */
@@ -0,0 +1,271 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#include "feat.h"
+
+#include "error.h"
+#include "scan.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+/* Input bytes read per step by scan_file */
+#define SCAN_CHUNK 49152
+
+static void scan_scalar(scan_p S, const unsigned char* src, size_t n);
+
+#ifdef SCAN_X86
+/* Vector scanners classify blocks of 16 or 32 bytes into bit masks, one bit
+ * per byte, then hand the remaining bytes over to scan_scalar */
+static void scan_sse2(scan_p S, const unsigned char* src, size_t n);
+static void scan_avx2(scan_p S, const unsigned char* src, size_t n);
+
+/**
+ * Account for a block of `width` bytes, given its masks: bytes to escape, NUL
+ * bytes, bytes above 127, <CR> and <LF> bytes.
+ */
+static void scan_masks(
+    scan_p       S,
+    unsigned int esc,
+    unsigned int nul,
+    unsigned int high,
+    unsigned int cr,
+    unsigned int lf,
+    unsigned int width
+);
+#endif
+
+/** Set by scan_init to the fastest scanner the CPU supports */
+static void (*scan_kernel)(scan_p S, const unsigned char* src, size_t n) =
+    scan_scalar;
+
+void scan_init(void)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        scan_kernel = scan_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        scan_kernel = scan_sse2;
+#endif
+}
+
+void scan_start(scan_p S)
+{
+    memset(S, 0, sizeof(*S));
+}
+
+void scan_buf(scan_p S, const char* buf, size_t n)
+{
+    scan_kernel(S, (const unsigned char*)buf, n);
+    S->size += n;
+}
+
+void scan_end(scan_p S)
+{
+    if (S->line > S->max_line)
+        S->max_line = S->line;
+}
+
+int scan_file(scan_p S, file_p in)
+{
+    char    buf[SCAN_CHUNK];
+    ssize_t rb;
+    int     res;
+
+    scan_start(S);
+
+    if (file_isreg(in))
+    {
+        res = file_seek(in, 0, SEEK_SET);
+        if (res != OK)
+        {
+            strncpy(error_message, "scan_file: seek set", MAX_ERROR_SIZE);
+            return res;
+        }
+    }
+
+    while ((rb = file_read(in, buf, sizeof(buf))) > 0)
+        scan_buf(S, buf, (size_t)rb);
+
+    if (rb < 0)
+    {
+        strncpy(error_message, "scan_file: read", MAX_ERROR_SIZE);
+        return ERRNO_SPLIT + errno;
+    }
+
+    scan_end(S);
+
+    return OK;
+}
+
+static void scan_scalar(scan_p S, const unsigned char* src, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+    {
+        switch (src[i])
+        {
+        case '\n':
+            ++S->lf;
+            if (S->last_cr)
+            {
+                ++S->crlf;
+                --S->line;
+            }
+
+            if (S->line > S->max_line)
+                S->max_line = S->line;
+            S->line    = 0;
+            S->last_cr = 0;
+            continue;
+        case '\r':
+            ++S->cr;
+            break;
+        case '\t':
+            break;
+        case '\0':
+            ++S->nul;
+            ++S->escapes;
+            break;
+        default:
+            if (src[i] < ' ' || src[i] > '~' || src[i] == '=')
+                ++S->escapes;
+            if (src[i] > 127)
+                ++S->high;
+            break;
+        }
+
+        ++S->line;
+        S->last_cr = src[i] == '\r';
+    }
+}
+
+#ifdef SCAN_X86
+/* Bytes are compared as signed: those above 127 are negative, thus below ' ' */
+
+__attribute__((target("sse2"))) static void
+scan_sse2(scan_p S, const unsigned char* src, size_t n)
+{
+    __m128i v;
+    __m128i ok;
+    size_t  i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        v  = _mm_loadu_si128((const __m128i*)(const void*)(src + i));
+        ok = _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8(' ' - 1)),
+            _mm_cmplt_epi8(v, _mm_set1_epi8('~' + 1))
+        );
+        ok = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('=')), ok);
+        ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+        ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+        ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+
+        scan_masks(
+            S,
+            (unsigned int)_mm_movemask_epi8(ok) ^ 0xFFFFu,
+            (unsigned int)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(v, _mm_setzero_si128())
+            ),
+            (unsigned int)_mm_movemask_epi8(v),
+            (unsigned int)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))
+            ),
+            (unsigned int)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))
+            ),
+            16
+        );
+    }
+
+    scan_scalar(S, src + i, n - i);
+}
+
+__attribute__((target("avx2"))) static void
+scan_avx2(scan_p S, const unsigned char* src, size_t n)
+{
+    __m256i v;
+    __m256i ok;
+    size_t  i;
+
+    for (i = 0; i + 32 <= n; i += 32)
+    {
+        v  = _mm256_loadu_si256((const __m256i*)(const void*)(src + i));
+        ok = _mm256_and_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(' ' - 1)),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8('~' + 1), v)
+        );
+        ok = _mm256_andnot_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('=')), ok
+        );
+        ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+        ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+        ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+
+        scan_masks(
+            S,
+            ~(unsigned int)_mm256_movemask_epi8(ok),
+            (unsigned int)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(v, _mm256_setzero_si256())
+            ),
+            (unsigned int)_mm256_movemask_epi8(v),
+            (unsigned int)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))
+            ),
+            (unsigned int)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))
+            ),
+            32
+        );
+    }
+
+    scan_sse2(S, src + i, n - i);
+}
+
+static void scan_masks(
+    scan_p       S,
+    unsigned int esc,
+    unsigned int nul,
+    unsigned int high,
+    unsigned int cr,
+    unsigned int lf,
+    unsigned int width
+)
+{
+    unsigned int after_cr = cr << 1 | (unsigned int)S->last_cr;
+    unsigned int pos;
+    unsigned int last = 0; /* Position following the last <LF> */
+
+    S->escapes += (size_t)__builtin_popcount(esc);
+    S->nul += (size_t)__builtin_popcount(nul);
+    S->high += (size_t)__builtin_popcount(high);
+    S->cr += (size_t)__builtin_popcount(cr);
+    S->lf += (size_t)__builtin_popcount(lf);
+    S->crlf += (size_t)__builtin_popcount(lf & after_cr);
+
+    /* Lines are rare compared to bytes: <LF>s are visited one by one */
+    for (; lf != 0; lf &= lf - 1)
+    {
+        pos = (unsigned int)__builtin_ctz(lf);
+        S->line += pos - last;
+        S->line -= after_cr >> pos & 1; /* The <CR> of <CR><LF> */
+
+        if (S->line > S->max_line)
+            S->max_line = S->line;
+
+        S->line = 0;
+        last    = pos + 1;
+    }
+
+    S->line += width - last;
+    S->last_cr = (int)(cr >> (width - 1) & 1);
+}
+#endif
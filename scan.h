@@ -0,0 +1,53 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#ifndef CMC_EML_SCAN_H_INCLUDED
+#define CMC_EML_SCAN_H_INCLUDED
+
+#include "io.h"
+
+#include <stddef.h>
+
+/* Content statistics, used to pick a transfer encoding */
+typedef struct scan_t
+{
+    size_t size;
+    size_t escapes;  /* Bytes that quoted-printable escapes, NUL included */
+    size_t nul;      /* NUL bytes */
+    size_t high;     /* Bytes above 127 */
+    size_t cr;       /* <CR> bytes */
+    size_t lf;       /* <LF> bytes */
+    size_t crlf;     /* <CR><LF> pairs */
+    size_t max_line; /* Longest line, line break excluded */
+
+    size_t line;    /* Length of the current line */
+    int    last_cr; /* The last byte scanned is <CR> */
+}* scan_p;
+
+/**
+ * Select the fastest scanner the CPU supports (AVX2 or SSE2 on x86, scalar
+ * otherwise); statistics are the same in any case.
+ *
+ * It must be called once, at startup, before any scan.
+ */
+extern void scan_init(void);
+
+extern void scan_start(scan_p S);
+
+/** Add the `n` bytes at `buf`, that follow those already scanned */
+extern void scan_buf(scan_p S, const char* buf, size_t n);
+
+/** Account for the last line; no byte shall be added after */
+extern void scan_end(scan_p S);
+
+/**
+ * Scan `in`, from its beginning if it is a regular file, from scan_start to
+ * scan_end.
+ *
+ * Return:
+ * - OK;
+ * - ERRNO_SPLIT + errno, on read error.
+ */
+extern int scan_file(scan_p S, file_p in);
+
+#endif /* CMC_EML_SCAN_H_INCLUDED */
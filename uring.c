@@ -0,0 +1,554 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#include "feat.h"
+
+#include "error.h"
+#include "uring.h"
+
+#include <string.h>
+
+#ifdef CMC_EML_URING
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+typedef struct uring_slot_t
+{
+    off_t off;      /* Offset of the read in the file */
+    int   inflight; /* Submitted, not completed yet */
+    int   res;      /* Bytes read or -errno, once completed */
+}* uring_slot_p;
+
+struct uring_t
+{
+    int ring_fd;
+
+    /* Submission queue */
+    void*                sq_map;
+    size_t               sq_map_size;
+    unsigned int*        sq_tail;
+    unsigned int*        sq_mask;
+    unsigned int*        sq_array;
+    struct io_uring_sqe* sqes;
+    size_t               sqes_size;
+
+    /* Completion queue */
+    void*                cq_map;
+    size_t               cq_map_size;
+    unsigned int*        cq_head;
+    unsigned int*        cq_tail;
+    unsigned int*        cq_mask;
+    struct io_uring_cqe* cqes;
+
+    /* Buffer pool: slot i reads into pool + i * URING_CHUNK */
+    unsigned char* pool;
+    struct iovec   iov[URING_DEPTH];
+    int            fixed; /* The pool is registered with the ring */
+
+    /* File being read, if busy */
+    int                 busy;
+    int                 failed; /* A submission failed: the ring is dropped */
+    int                 fd;
+    int                 idle;     /* Nothing in flight: the file offset holds */
+    off_t               logical;  /* Offset of the next byte to return */
+    off_t               next_off; /* Offset of the next read to submit */
+    int                 head;     /* Slot holding the next bytes to return */
+    size_t              pos;      /* Bytes of the head slot returned */
+    struct uring_slot_t slots[URING_DEPTH];
+};
+
+typedef struct uring_t* uring_p;
+
+static int            uring_enabled = 0;
+static pthread_key_t  uring_key;
+static pthread_once_t uring_once = PTHREAD_ONCE_INIT;
+
+static void uring_key_init(void);
+
+/** Ring of the calling thread, set up on first use; NULL if it cannot be */
+static uring_p uring_get(void);
+
+/** Set up a ring and its pool; NULL on failure */
+static uring_p uring_new(void);
+
+/** Thread-specific data destructor */
+static void uring_free(void* arg);
+
+/** Fill the submission entry of `slot`, to read at `off` */
+static void uring_prep(uring_p R, int slot, off_t off);
+
+/** Submit `n` entries prepared by uring_prep; -1 on error (errno is set) */
+static int uring_submit(uring_p R, unsigned int n);
+
+/** Reap completions, waiting until `slot` is no more in flight */
+static int uring_wait(uring_p R, int slot);
+
+/** Submit all slots from R->logical on; -1 on error (errno is set) */
+static int uring_start(uring_p R);
+
+/** Wait for all slots in flight */
+static int uring_drain(uring_p R);
+
+int uring_enable(void)
+{
+    uring_p R;
+
+    /* Probe on the calling thread, whose ring is then ready */
+    uring_enabled = 1;
+
+    R = uring_get();
+    if (R == NULL)
+    {
+        uring_enabled = 0;
+        return NOT_FOUND;
+    }
+
+    return OK;
+}
+
+int uring_open(file_p F)
+{
+    uring_p     R;
+    struct stat s;
+
+    assert(F != NULL, FATAL_LOGIC, "uring_open: invalid file");
+
+    if (!uring_enabled || F->ur != NULL || F->gz != NULL ||
+        F->charset != CHARSET_UTF8)
+        return NOT_FOUND;
+
+    if (fstat(F->fd, &s) != 0 || !S_ISREG(s.st_mode))
+        return NOT_FOUND;
+
+    R = uring_get();
+    if (R == NULL || R->busy)
+        return NOT_FOUND;
+
+    R->busy = 1;
+    R->fd   = F->fd;
+    R->idle = 1;
+    F->ur   = R;
+
+    return OK;
+}
+
+ssize_t uring_read(file_p F, char* buf, size_t max)
+{
+    uring_p      R = F->ur;
+    uring_slot_p S;
+    off_t        off;
+    size_t       n;
+
+    if (R->failed)
+    {
+        errno = R->failed;
+        return -1;
+    }
+
+    if (max == 0)
+        return 0;
+
+    if (R->idle)
+    {
+        off = lseek(R->fd, 0, SEEK_CUR);
+        if (off < 0)
+            return -1;
+
+        R->logical = off;
+        if (uring_start(R) != 0)
+            return -1;
+    }
+
+    S = R->slots + R->head;
+    if (uring_wait(R, R->head) != 0)
+        return -1;
+
+    if (S->res < 0)
+    {
+        errno = -S->res;
+        return -1;
+    }
+
+    /* The end of the file: it stays so, as read(2) would */
+    if (S->res == 0)
+        return 0;
+
+    n = (size_t)S->res - R->pos;
+    if (n > max)
+        n = max;
+
+    memcpy(buf, R->pool + (size_t)R->head * URING_CHUNK + R->pos, n);
+    R->pos += n;
+    R->logical += (off_t)n;
+
+    if (R->pos < (size_t)S->res)
+        return (ssize_t)n;
+
+    /* A short read leaves a gap before the slots that follow: they are read
+     * again, from where this one ends */
+    if (S->res < URING_CHUNK)
+    {
+        if (uring_drain(R) != 0 || uring_start(R) != 0)
+            return -1;
+
+        return (ssize_t)n;
+    }
+
+    uring_prep(R, R->head, R->next_off);
+    R->next_off += URING_CHUNK;
+
+    if (uring_submit(R, 1) != 0)
+        return -1;
+
+    R->head = (R->head + 1) % URING_DEPTH;
+    R->pos  = 0;
+
+    return (ssize_t)n;
+}
+
+int uring_sync(file_p F)
+{
+    uring_p R = F->ur;
+
+    if (R->idle)
+        return OK;
+
+    if (uring_drain(R) != 0)
+        return ERRNO_SPLIT + errno;
+    R->idle = 1;
+
+    if (lseek(R->fd, R->logical, SEEK_SET) < 0)
+        return ERRNO_SPLIT + errno;
+
+    return OK;
+}
+
+void uring_close(file_p F)
+{
+    uring_p R = F->ur;
+
+    if (!R->idle)
+        uring_drain(R);
+
+    R->busy = 0;
+    R->fd   = -1;
+    F->ur   = NULL;
+
+    /* Closing the ring cancels what may still be in flight */
+    if (R->failed)
+    {
+        pthread_setspecific(uring_key, NULL);
+        uring_free(R);
+    }
+}
+
+static void uring_key_init(void)
+{
+    if (pthread_key_create(&uring_key, uring_free) != 0)
+        uring_enabled = 0;
+}
+
+static uring_p uring_get(void)
+{
+    uring_p R;
+
+    pthread_once(&uring_once, uring_key_init);
+    if (!uring_enabled)
+        return NULL;
+
+    R = pthread_getspecific(uring_key);
+    if (R == NULL)
+    {
+        R = uring_new();
+        if (R != NULL && pthread_setspecific(uring_key, R) != 0)
+        {
+            uring_free(R);
+            R = NULL;
+        }
+    }
+
+    return R;
+}
+
+static uring_p uring_new(void)
+{
+    struct io_uring_params p;
+    uring_p                R;
+    long                   res;
+    int                    i;
+
+    R = calloc(1, sizeof(*R));
+    if (R == NULL)
+        return NULL;
+
+    R->ring_fd = -1;
+    R->sq_map  = MAP_FAILED;
+    R->cq_map  = MAP_FAILED;
+    R->sqes    = MAP_FAILED;
+    R->pool    = MAP_FAILED;
+    R->fd      = -1;
+
+    memset(&p, 0, sizeof(p));
+    res = syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+    if (res < 0)
+    {
+        uring_free(R);
+        return NULL;
+    }
+    R->ring_fd     = (int)res;
+
+    R->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    R->sq_map      = mmap(
+        NULL,
+        R->sq_map_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        R->ring_fd,
+        IORING_OFF_SQ_RING
+    );
+
+    R->cq_map_size =
+        p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    R->cq_map = mmap(
+        NULL,
+        R->cq_map_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        R->ring_fd,
+        IORING_OFF_CQ_RING
+    );
+
+    R->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    R->sqes      = mmap(
+        NULL,
+        R->sqes_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        R->ring_fd,
+        IORING_OFF_SQES
+    );
+
+    R->pool = mmap(
+        NULL,
+        (size_t)URING_DEPTH * URING_CHUNK,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0
+    );
+
+    if (R->sq_map == MAP_FAILED || R->cq_map == MAP_FAILED ||
+        R->sqes == MAP_FAILED || R->pool == MAP_FAILED)
+    {
+        uring_free(R);
+        return NULL;
+    }
+
+    R->sq_tail  = (unsigned int*)((char*)R->sq_map + p.sq_off.tail);
+    R->sq_mask  = (unsigned int*)((char*)R->sq_map + p.sq_off.ring_mask);
+    R->sq_array = (unsigned int*)((char*)R->sq_map + p.sq_off.array);
+    R->cq_head  = (unsigned int*)((char*)R->cq_map + p.cq_off.head);
+    R->cq_tail  = (unsigned int*)((char*)R->cq_map + p.cq_off.tail);
+    R->cq_mask  = (unsigned int*)((char*)R->cq_map + p.cq_off.ring_mask);
+    R->cqes     = (struct io_uring_cqe*)((char*)R->cq_map + p.cq_off.cqes);
+
+    for (i = 0; i < URING_DEPTH; ++i)
+    {
+        R->iov[i].iov_base = R->pool + (size_t)i * URING_CHUNK;
+        R->iov[i].iov_len  = URING_CHUNK;
+    }
+
+    /* Pinned pages count against RLIMIT_MEMLOCK: plain readv otherwise */
+    res = syscall(
+        __NR_io_uring_register,
+        R->ring_fd,
+        IORING_REGISTER_BUFFERS,
+        R->iov,
+        URING_DEPTH
+    );
+    R->fixed = res == 0;
+
+    return R;
+}
+
+static void uring_free(void* arg)
+{
+    uring_p R = arg;
+
+    if (R->pool != MAP_FAILED)
+        munmap(R->pool, (size_t)URING_DEPTH * URING_CHUNK);
+    if (R->sqes != MAP_FAILED)
+        munmap(R->sqes, R->sqes_size);
+    if (R->cq_map != MAP_FAILED)
+        munmap(R->cq_map, R->cq_map_size);
+    if (R->sq_map != MAP_FAILED)
+        munmap(R->sq_map, R->sq_map_size);
+    if (R->ring_fd >= 0)
+        close(R->ring_fd);
+
+    free(R);
+}
+
+static void uring_prep(uring_p R, int slot, off_t off)
+{
+    struct io_uring_sqe* e;
+    unsigned int         tail;
+
+    tail = *R->sq_tail;
+    e    = R->sqes + slot;
+
+    memset(e, 0, sizeof(*e));
+    e->fd        = R->fd;
+    e->off       = (__u64)off;
+    e->user_data = (__u64)slot;
+
+    if (R->fixed)
+    {
+        e->opcode    = IORING_OP_READ_FIXED;
+        e->addr      = (__u64)(size_t)R->iov[slot].iov_base;
+        e->len       = URING_CHUNK;
+        e->buf_index = (__u16)slot;
+    }
+    else
+    {
+        e->opcode = IORING_OP_READV;
+        e->addr   = (__u64)(size_t)(R->iov + slot);
+        e->len    = 1;
+    }
+
+    R->sq_array[tail & *R->sq_mask] = (unsigned int)slot;
+    __atomic_store_n(R->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    R->slots[slot].off      = off;
+    R->slots[slot].inflight = 1;
+}
+
+static int uring_submit(uring_p R, unsigned int n)
+{
+    long res;
+
+    while (n > 0)
+    {
+        res = syscall(__NR_io_uring_enter, R->ring_fd, n, 0, 0, NULL, 0);
+        if (res < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+
+            /* Which reads are in flight is unknown: none is waited for */
+            R->failed = errno;
+            return -1;
+        }
+
+        n -= (unsigned int)res;
+    }
+
+    return 0;
+}
+
+static int uring_wait(uring_p R, int slot)
+{
+    struct io_uring_cqe* c;
+    uring_slot_p         S;
+    unsigned int         head;
+    long                 res;
+
+    for (;;)
+    {
+        head = *R->cq_head;
+        while (head != __atomic_load_n(R->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            c           = R->cqes + (head & *R->cq_mask);
+            S           = R->slots + (size_t)c->user_data;
+            S->res      = c->res;
+            S->inflight = 0;
+            ++head;
+        }
+        __atomic_store_n(R->cq_head, head, __ATOMIC_RELEASE);
+
+        if (!R->slots[slot].inflight)
+            return 0;
+
+        res = syscall(
+            __NR_io_uring_enter,
+            R->ring_fd,
+            0,
+            1,
+            IORING_ENTER_GETEVENTS,
+            NULL,
+            0
+        );
+        if (res < 0 && errno != EINTR)
+        {
+            R->failed = errno;
+            return -1;
+        }
+    }
+}
+
+static int uring_start(uring_p R)
+{
+    int i;
+
+    R->next_off = R->logical;
+    R->head     = 0;
+    R->pos      = 0;
+    R->idle     = 0;
+
+    for (i = 0; i < URING_DEPTH; ++i)
+    {
+        uring_prep(R, i, R->next_off);
+        R->next_off += URING_CHUNK;
+    }
+
+    return uring_submit(R, URING_DEPTH);
+}
+
+static int uring_drain(uring_p R)
+{
+    int i;
+
+    if (R->failed)
+        return -1;
+
+    for (i = 0; i < URING_DEPTH; ++i)
+        if (R->slots[i].inflight && uring_wait(R, i) != 0)
+            return -1;
+
+    return 0;
+}
+#else
+int uring_enable(void) { return NOT_FOUND; }
+
+int uring_open(file_p F)
+{
+    (void)F;
+
+    return NOT_FOUND;
+}
+
+ssize_t uring_read(file_p F, char* buf, size_t max)
+{
+    (void)F;
+    (void)buf;
+    (void)max;
+
+    errno = ENOSYS;
+    return -1;
+}
+
+int uring_sync(file_p F)
+{
+    (void)F;
+
+    return OK;
+}
+
+void uring_close(file_p F) { (void)F; }
+#endif
@@ -0,0 +1,68 @@
+/* Copyright (c) 2025 Mattia Cabrini */
+/* SPDX-License-Identifier: MIT      */
+
+#ifndef CMC_EML_URING_H_INCLUDED
+#define CMC_EML_URING_H_INCLUDED
+
+#include "feat.h"
+
+#include "io.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * io_uring read-ahead for regular files.
+ *
+ * Each thread has its own ring, set up on first use, and a pool of
+ * URING_DEPTH buffers of URING_CHUNK bytes, registered with the ring if the
+ * kernel lets it. A file set by uring_open keeps URING_DEPTH reads in flight,
+ * at consecutive offsets past what file_read has returned so far; one file per
+ * thread at a time.
+ *
+ * It is built only if CMC_EML_URING is defined (linux/io_uring.h found at
+ * configure time) and used only once enabled by uring_enable; otherwise files
+ * are read by read(2).
+ */
+
+/* Reads in flight per file */
+#define URING_DEPTH 4
+
+/* Bytes per read */
+#define URING_CHUNK 131072
+
+/**
+ * Enable the backend for the files opened from now on, if the kernel supports
+ * io_uring.
+ *
+ * Return OK, or NOT_FOUND if io_uring is not available: files are read by
+ * read(2), as before.
+ */
+extern int uring_enable(void);
+
+/**
+ * Have F, a regular file just opened, read ahead by the ring of the calling
+ * thread; file_read, file_seek, file_cur and file_close handle it as any other
+ * file. F shall only be used by the calling thread.
+ *
+ * Return OK, or NOT_FOUND if the backend is not enabled, F is not a regular
+ * file or the ring of the thread is busy with another file: F is left as is.
+ */
+extern int uring_open(file_p F);
+
+/** file_read of a file set by uring_open */
+extern ssize_t uring_read(file_p F, char* buf, size_t max);
+
+/**
+ * Wait for the reads in flight and move the file offset of F to what has been
+ * read so far, so that F can be used by anything else (lseek, sendfile...).
+ * The next uring_read starts again from the file offset.
+ *
+ * Return OK, or ERRNO_SPLIT + errno if lseek fails.
+ */
+extern int uring_sync(file_p F);
+
+/** Release the ring of F, before it is closed */
+extern void uring_close(file_p F);
+
+#endif /* CMC_EML_URING_H_INCLUDED */
@@ -3,8 +3,12 @@
 
 #include "feat.h"
 
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "error.h"
 #include "util.h"
@@ -25,6 +29,23 @@ static void rbuffer_next(rbuffer_p B)
     assert(B->count >= 0, FATAL_SIGSEGV, "rbuffer_next: could not read");
 }
 
+ssize_t rbuffer_fill(rbuffer_p B)
+{
+    if (B->cur == B->count)
+    {
+        B->count = file_read(B->F, B->buffer, sizeof(B->buffer));
+        B->cur   = 0;
+
+        if (B->count < 0)
+        {
+            B->count = 0;
+            return -1;
+        }
+    }
+
+    return B->count - B->cur;
+}
+
 ssize_t rbuffer_read(rbuffer_p B, char* dst, ssize_t sz)
 {
     ssize_t dst_i = 0;
@@ -56,14 +77,18 @@ void wbuffer_init(wbuffer_p B, file_p F)
     B->cur = 0;
 }
 
-void wbuffer_put(wbuffer_p B, char* buf, int sz)
+int wbuffer_put(wbuffer_p B, const char* buf, int sz)
 {
     int cur;
+    int res;
 
     for (cur = 0; cur < sz;)
     {
         if (B->cur == sizeof(B->buffer))
-            wbuffer_flush(B);
+        {
+            res = wbuffer_flush(B);
+            return_iferr(res);
+        }
 
         for (; cur < sz && B->cur < sizeof(B->buffer); ++cur)
         {
@@ -71,15 +96,43 @@ void wbuffer_put(wbuffer_p B, char* buf, int sz)
             ++B->cur;
         }
     }
+
+    return OK;
 }
 
-void wbuffer_flush(wbuffer_p B)
+int wbuffer_flush(wbuffer_p B)
 {
-    ssize_t res;
+    int res;
 
     res = file_write(B->F, B->buffer, B->cur);
-    assert(res == OK, FATAL_SIGSEGV, "wbuffer_flush: could not write");
+    if (res != OK)
+    {
+        strncpy(
+            error_message, "wbuffer_flush: could not write", MAX_ERROR_SIZE
+        );
+        return res;
+    }
+
     B->cur = 0;
+
+    return OK;
+}
+
+int wbuffer_room(wbuffer_p B, size_t n, char** dst)
+{
+    int res;
+
+    assert(n <= sizeof(B->buffer), FATAL_LOGIC, "wbuffer_room: n too big");
+
+    if (sizeof(B->buffer) - B->cur < n)
+    {
+        res = wbuffer_flush(B);
+        return_iferr(res);
+    }
+
+    *dst = B->buffer + B->cur;
+
+    return OK;
 }
 
 int strnappend(char* dst, const char* src, int n)
@@ -145,8 +198,106 @@ int strnappendvv(char* dst, int n, va_list args)
     return cpin < 0 ? cpin : cp;
 }
 
+int strtosize(const char* str, size_t* sz)
+{
+    size_t digit;
+
+    *sz = 0;
+
+    if (str == NULL || *str == '\0')
+        return ILLEGAL_FORMAT;
+
+    for (; *str; ++str)
+    {
+        if (*str < '0' || *str > '9')
+            return ILLEGAL_FORMAT;
+
+        digit = (size_t)(*str - '0');
+        if (*sz > ((size_t)-1 - digit) / 10)
+            return ILLEGAL_FORMAT;
+
+        *sz = *sz * 10 + digit;
+    }
+
+    return OK;
+}
+
+/* xoshiro128** state, one per thread: no lock, no shared sequence */
+static __thread unsigned long rand_state[4];
+static __thread int           rand_seeded = 0;
+
+#define RAND_MASK 0xFFFFFFFFUL
+#define rand_rotl(x, k) ((((x) << (k)) | ((x) >> (32 - (k)))) & RAND_MASK)
+
+/** Seed the state of the calling thread, from /dev/urandom if available */
+static void rand_seed(void);
+
+/** Next 32 random bits of the calling thread */
+static unsigned long rand_next(void);
+
+static void rand_seed(void)
+{
+    unsigned char seed[16];
+    unsigned long x = 0;
+    unsigned long z;
+    int           fd;
+    int           i;
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0 || read(fd, seed, sizeof(seed)) != (ssize_t)sizeof(seed))
+    {
+        /* Still distinct among threads, by the address of their state */
+        x = (unsigned long)time(NULL) ^ (unsigned long)getpid() ^
+            (unsigned long)clock() ^ (unsigned long)(size_t)rand_state;
+        memset(seed, 0, sizeof(seed));
+    }
+    if (fd >= 0)
+        close(fd);
+
+    /* splitmix32 spreads the seed over the whole state, never all zero */
+    for (i = 0; i < 4; ++i)
+    {
+        x += 0x9E3779B9UL + ((unsigned long)seed[4 * i] << 24 |
+                             (unsigned long)seed[4 * i + 1] << 16 |
+                             (unsigned long)seed[4 * i + 2] << 8 |
+                             (unsigned long)seed[4 * i + 3]);
+        x &= RAND_MASK;
+
+        /* murmur3 finalizer */
+        z = ((x ^ (x >> 16)) * 0x85EBCA6BUL) & RAND_MASK;
+        z = ((z ^ (z >> 13)) * 0xC2B2AE35UL) & RAND_MASK;
+
+        rand_state[i] = z ^ (z >> 16);
+    }
+
+    rand_seeded = 1;
+}
+
+static unsigned long rand_next(void)
+{
+    unsigned long* s = rand_state;
+    unsigned long  res;
+    unsigned long  t;
+
+    res  = (rand_rotl((s[1] * 5) & RAND_MASK, 7) * 9) & RAND_MASK;
+    t    = (s[1] << 9) & RAND_MASK;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rand_rotl(s[3], 11);
+
+    return res;
+}
+
 void get_rand_string(char* str, size_t n)
 {
+    if (!rand_seeded)
+        rand_seed();
+
+    /* The high bits, scaled to [0; 26) */
     while (n--)
-        str[n] = (char)('a' + ((unsigned)rand()) % 26);
+        str[n] = (char)('a' + (int)(((rand_next() >> 16) * 26) >> 16));
 }
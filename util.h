@@ -8,6 +8,7 @@
 
 #include "io.h"
 
+#include <stdarg.h>
 #include <stddef.h>
 #include <sys/types.h>
 
@@ -31,9 +32,38 @@ typedef struct wbuffer_t
 extern void    rbuffer_init(rbuffer_p B, file_p F);
 extern ssize_t rbuffer_read(rbuffer_p B, char* dst, ssize_t sz);
 
+/**
+ * Make sure that at least one byte is buffered, reading a new block from the
+ * underlying file only if the buffer has been fully consumed.
+ *
+ * Buffered bytes are in range [B->buffer + B->cur; B->buffer + B->count); the
+ * caller consumes them by advancing B->cur.
+ *
+ * Return:
+ * - the number of buffered bytes not yet consumed;
+ * - 0 on EOF;
+ * - -1 on read error (errno is set).
+ */
+extern ssize_t rbuffer_fill(rbuffer_p B);
+
 extern void wbuffer_init(wbuffer_p B, file_p F);
-extern void wbuffer_put(wbuffer_p B, char* buf, int sz);
-extern void wbuffer_flush(wbuffer_p B);
+extern int  wbuffer_put(wbuffer_p B, const char* buf, int sz);
+
+/**
+ * Write what B holds and empty it.
+ *
+ * Return OK, or ERRNO_SPLIT + errno on write error (error_message is set).
+ */
+extern int wbuffer_flush(wbuffer_p B);
+
+/**
+ * Make room for `n` bytes, at most FS_BUFFER_SIZE, flushing the buffer if
+ * needed, and set *dst to where to write them; the caller shall advance B->cur
+ * by the number of bytes written.
+ *
+ * Return OK, or the wbuffer_flush error.
+ */
+extern int wbuffer_room(wbuffer_p B, size_t n, char** dst);
 
 #define sizeof_i(TYPE) ((int)sizeof(TYPE))
 
@@ -84,12 +114,24 @@ extern int strnappendv(char* dst, int n, ...);
  */
 extern int strnappendvv(char* dst, int n, va_list args);
 
+/**
+ * Parse a non-negative decimal size; the whole string must be made up by
+ * digits.
+ *
+ * RETURN
+ * OK, or ILLEGAL_FORMAT if `str` is NULL, empty, not a number or too big.
+ */
+extern int strtosize(const char* str, size_t* sz);
+
 /**
  * Set all 'n' character in the buffer `buf` to an ASCII character between 'a'
  * and 'z'.
  *
  * The resulting buffer will not be NUL-terminated and therefore will not be a
  * valid C-string.
+ *
+ * Each thread has its own generator (xoshiro128**), seeded on first use: it is
+ * safe to call from any thread, with no lock.
  */
 void get_rand_string(char* buf, size_t n);
 